@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "errmsg.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK 4096    /* chunk size used when create_arena gets 0 */
+
+struct arena_chunk
+{
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+/*
+ * A bump allocator. Allocations are carved out of the current chunk and
+ * only released all at once by clear_arena, which keeps the first chunk,
+ * so the common short command line never touches malloc.
+ */
+struct arena_record
+{
+    struct arena_chunk *head;   /* chunk allocations come from */
+    struct arena_chunk *first;  /* chunk kept across clear_arena */
+    size_t chunk_size;
+};
+
+static struct arena_chunk *create_chunk(size_t size, struct arena_chunk *next)
+{
+    struct arena_chunk *c;
+    if ((c = malloc(sizeof(struct arena_chunk) + size)) == NULL) {
+        app_error("out of space!!");
+        return NULL;
+    }
+    c->next = next;
+    c->size = size;
+    c->used = 0;
+    return c;
+}
+
+arena create_arena(size_t chunk_size)
+{
+    arena a;
+    if ((a = malloc(sizeof(struct arena_record))) == NULL) {
+        app_error("out of space!!");
+        return NULL;
+    }
+    a->chunk_size = chunk_size > 0 ? chunk_size : ARENA_CHUNK;
+    a->first = a->head = create_chunk(a->chunk_size, NULL);
+    return a;
+}
+
+void clear_arena(arena a)
+{
+    struct arena_chunk *c;
+    while (a->head != a->first) {
+        c = a->head;
+        a->head = c->next;
+        free(c);
+    }
+    a->first->used = 0;
+}
+
+void dispose_arena(arena a)
+{
+    clear_arena(a);
+    free(a->first);
+    free(a);
+}
+
+void *alloc_arena(arena a, size_t size)
+{
+    void *p;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (a->head->used + size > a->head->size) {
+        a->head = create_chunk(size > a->chunk_size ? size : a->chunk_size, a->head);
+    }
+    p = a->head->data + a->head->used;
+    a->head->used += size;
+    return p;
+}
+
+char *strdup_arena(arena a, const char *s)
+{
+    size_t n = strlen(s) + 1;
+    return memcpy(alloc_arena(a, n), s, n);
+}
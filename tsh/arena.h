@@ -0,0 +1,20 @@
+#ifndef OS_HW_ARENA_H
+#define OS_HW_ARENA_H
+
+#include <stddef.h>
+
+struct arena_record;
+
+typedef struct arena_record *arena;
+
+arena create_arena(size_t chunk_size);
+
+void dispose_arena(arena a);
+
+void clear_arena(arena a);
+
+void *alloc_arena(arena a, size_t size);
+
+char *strdup_arena(arena a, const char *s);
+
+#endif //OS_HW_ARENA_H
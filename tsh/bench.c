@@ -0,0 +1,1012 @@
+/*
+ * tsh_bench - Benchmarks for the shell's hot paths
+ *
+ * Every benchmark runs a fixed amount of work, scaled by -s, so runs on
+ * the same machine can be compared line by line to catch regressions.
+ *
+ * Usage: tsh_bench [-s scale] [-c corpus] [benchmark...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "errmsg.h"
+#include "job.h"
+#include "linked_hash_table.h"
+#include "parse.h"
+#include "exec.h"
+#include "script.h"
+#include "history.h"
+#include "histsearch.h"
+#include "complete.h"
+#include "bookmark.h"
+#include "frecency.h"
+
+#define PIPE_BYTES (64L << 20)  /* bytes pushed through each pipeline */
+#define HUGE_LINE  (64 << 10)   /* a line far past the old 1 KB limit */
+#define LEGACY_MAXARGS 128      /* the old fixed argv size */
+#define SCRIPT_LINES 200000     /* lines in the script_read script */
+#define HISTORY_LINES 100000    /* entries in the history_search history */
+#define COMPLETE_FILES 20000    /* files in the complete directory */
+#define BOOKMARKS 10000         /* bookmarks in the bookmarks benchmark */
+#define JUMP_DIRS 100000        /* visited directories in the frecency benchmark */
+#define BG_JOBS 2000            /* background jobs in the bg_jobs benchmark */
+#define SHELL_LINES 500         /* script lines per shell_lines run */
+#define SCRIPT_RUNS 50          /* runs of the 32-line script per builtin_scripts mode */
+
+typedef void bench_t(long scale);
+
+struct benchmark
+{
+    const char *name;
+    bench_t *func;
+};
+
+/* default parse_line corpus, used when no -c file is given */
+static const char *default_corpus[] = {
+    "ls -l\n",
+    "ls -l /usr/bin | grep rw | sort > out.txt\n",
+    "cat <(ls -l | grep rw) <(sort data.txt) > merged.txt &\n",
+    "gcc -O2 -Wall -Wextra -std=gnu99 -I include -I ../common -o build/tsh tsh.c job.c sigutil.c stack.c\n",
+    "find . -name core -o -name a.out | xargs rm -f\n",
+    "sort -k 2 -n < input.txt | uniq -c | sort -rn | head -n 20 > top.txt\n",
+    "tar cf - src docs tests | gzip -9 > >(tee backup.tgz) \n",
+    "   sleep 10 &\n",
+    NULL
+};
+
+static char **corpus = (char **) default_corpus;
+
+/* now_ns - Monotonic clock in nanoseconds */
+static long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* report - Print one result line */
+static void report(const char *name, long ops, long ns, const char *extra)
+{
+    printf("%-24s %10ld ops %14.1f ns/op  %s\n", name, ops, (double) ns / ops, extra);
+    fflush(stdout);
+}
+
+/*
+ * legacy_first_tok - Returns a pointer to the first (lowest addy) of the four pointers
+ *     that isn't NULL.
+ */
+static char *legacy_first_tok(const char *space, const char *input, const char *output, const char *pipe, const char *right)
+{
+    const char *possible[5];
+    unsigned long min;
+    int n = 0;
+    if (space != NULL) {
+        possible[n++] = space;
+    }
+    if (input != NULL) {
+        possible[n++] = input;
+    }
+    if (output != NULL) {
+        possible[n++] = output;
+    }
+    if (pipe != NULL) {
+        possible[n++] = pipe;
+    }
+    if (right != NULL) {
+        possible[n++] = right;
+    }
+    if (n == 0) {
+        return NULL;
+    }
+    min = (unsigned long) possible[0];
+    for (int i = 1; i < n; i++) {
+        if (((unsigned long) possible[i]) < min)
+            min = (unsigned long) possible[i];
+    }
+    return (char *) min;
+}
+
+/*
+ * legacy_parse_line - The strchr-rescan parser parse_line replaced, kept
+ *     as the baseline for the parse_line benchmark.
+ */
+static int legacy_parse_line(const char *cmdline, int *p_argc, char **argv)
+{
+    static char array[MAXLINE]; /* holds local copy of command line */
+    char *buf = array;          /* ptr that traverses command line */
+    char *delim_space;          /* points to first space delimiter */
+    char *delim_in;             /* points to the first < delimiter */
+    char *delim_out;            /* points to the first > delimiter */
+    char *delim_pipe;           /* points to the first | delimiter */
+    char *delim_right;          /* points to the first ) delimiter */
+    char *delim;                /* points to the first delimiter */
+    int argc;               /* number of args */
+    int bg;                     /* background job? */
+    char *last_space = NULL;    /* The address of the last space  */
+
+    strcpy(buf, cmdline);
+    buf[strlen(buf) - 1] = ' ';  /* replace trailing '\n' with space */
+    while (*buf && (*buf == ' ')) /* ignore leading spaces */
+        buf++;
+
+    /* Build the argv list */
+    argc = 0;
+    delim_space = strchr(buf, ' ');
+    delim_in = strchr(buf, '<');
+    delim_out = strchr(buf, '>');
+    delim_pipe = strchr(buf, '|');
+    delim_right = strchr(buf, ')');
+    while ((delim = legacy_first_tok(delim_space, delim_in, delim_out, delim_pipe, delim_right))) {
+        if (delim == delim_space) {
+            *delim = '\0';
+            if (strlen(buf) != 0) {
+                argv[argc++] = buf;
+            }
+            last_space = delim;
+        } else if (delim == delim_in) {
+            if ((last_space && last_space != (delim - 1)) || !last_space) {
+                *delim = '\0';
+                if (strlen(buf) != 0) {
+                    argv[argc++] = buf;
+                }
+            }
+            if (*(delim + 1) == '(') {
+                delim++;
+                argv[argc++] = "<(";
+            } else {
+                argv[argc++] = "<";
+            }
+            last_space = 0;
+        } else if (delim == delim_out) {
+            if ((last_space && last_space != (delim - 1)) || !last_space) {
+                *delim = '\0';
+                if (strlen(buf) != 0) {
+                    argv[argc++] = buf;
+                }
+            }
+            if (*(delim + 1) == '(') {
+                delim++;
+                argv[argc++] = ">(";
+            } else {
+                argv[argc++] = ">";
+            }
+            last_space = 0;
+        } else if (delim == delim_pipe) {
+            if ((last_space && last_space != (delim - 1)) || !last_space) {
+                *delim = '\0';
+                if (strlen(buf) != 0) {
+                    argv[argc++] = buf;
+                }
+            }
+            argv[argc++] = "|";
+            last_space = 0;
+        } else if (delim == delim_right) {
+            if ((last_space && last_space != (delim - 1)) || !last_space) {
+                *delim = '\0';
+                if (strlen(buf) != 0) {
+                    argv[argc++] = buf;
+                }
+            }
+            argv[argc++] = ")";
+            last_space = 0;
+        }
+        buf = delim + 1;
+        while (*buf && (*buf == ' ')) /* ignore spaces */
+            buf++;
+        delim_space = strchr(buf, ' ');
+        delim_in = strchr(buf, '<');
+        delim_out = strchr(buf, '>');
+        delim_pipe = strchr(buf, '|');
+        delim_right = strchr(buf, ')');
+    }
+    argv[argc] = NULL;
+    if (argc == 0)  /* ignore blank line */
+        return 1;
+    /* should the job run in the background? */
+    if ((bg = (*argv[argc - 1] == '&')) != 0)
+        argv[--argc] = NULL;
+    *p_argc = argc;
+    return bg;
+}
+
+/* legacy_parse - legacy_parse_line behind the parse_line signature */
+static int legacy_parse(const char *cmdline, int *p_argc, char ***p_argv, arena a)
+{
+    static char *argv[LEGACY_MAXARGS];
+    *p_argv = argv;
+    return legacy_parse_line(cmdline, p_argc, argv);
+}
+
+/* load_corpus - Read a parse_line corpus, one command line per line */
+static void load_corpus(const char *filename)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t size = 0;
+    int n = 0, cap = 64;
+    if ((fp = fopen(filename, "r")) == NULL)
+        unix_error("load_corpus: fopen failed");
+    if ((corpus = malloc(cap * sizeof(char *))) == NULL)
+        app_error("out of space!!");
+    while (getline(&line, &size, fp) >= 0) {
+        if (n + 1 == cap && (corpus = realloc(corpus, (cap *= 2) * sizeof(char *))) == NULL)
+            app_error("out of space!!");
+        corpus[n++] = strdup(line);
+    }
+    corpus[n] = NULL;
+    free(line);
+    fclose(fp);
+}
+
+/* run_line - Fork, run a parsed line through f in the child, and wait */
+static void run_line(const char *cmdline, void (*f)(int argc, char **argv))
+{
+    char **argv;
+    int argc;
+    pid_t pid;
+    parse_line(cmdline, &argc, &argv, cmd_arena);
+    if ((pid = fork()) == 0) {
+        f(argc, argv);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    clear_arena(cmd_arena);
+}
+
+/* run_parser - Parse the corpus over and over with parser */
+static void run_parser(const char *name, long ops,
+                       int (*parser)(const char *cmdline, int *p_argc, char ***p_argv, arena a))
+{
+    char **argv;
+    int argc, n = 0;
+    long bytes = 0;
+    long start = now_ns();
+    char extra[64];
+    for (long i = 0; i < ops; i++) {
+        if (corpus[n] == NULL)
+            n = 0;
+        bytes += strlen(corpus[n]);
+        parser(corpus[n++], &argc, &argv, cmd_arena);
+        clear_arena(cmd_arena);
+    }
+    long ns = now_ns() - start;
+    sprintf(extra, "%.1f MB/s", bytes * 1e3 / ns);
+    report(name, ops, ns, extra);
+}
+
+void bench_parse_line(long scale)
+{
+    static char long_line[MAXLINE];
+    static char huge_line[HUGE_LINE];
+    char *long_corpus[] = {long_line, NULL};
+    char *huge_corpus[] = {huge_line, NULL};
+    char **saved = corpus;
+    int n = sprintf(long_line, "cc -o prog");
+
+    run_parser("parse_line", 100000 * scale, parse_line);
+    run_parser("parse_line/legacy", 100000 * scale, legacy_parse);
+
+    /* a long, argument-heavy line */
+    for (int i = 0; n < MAXLINE - 16; i++)
+        n += sprintf(long_line + n, " obj/f%d.o", i);
+    sprintf(long_line + n, "\n");
+    corpus = long_corpus;
+    run_parser("parse_line/long", 10000 * scale, parse_line);
+    run_parser("parse_line/long/legacy", 10000 * scale, legacy_parse);
+
+    /* only the arena parser can take this one */
+    n = sprintf(huge_line, "cc -o prog");
+    for (int i = 0; n < HUGE_LINE - 16; i++)
+        n += sprintf(huge_line + n, " obj/f%d.o", i);
+    sprintf(huge_line + n, "\n");
+    corpus = huge_corpus;
+    run_parser("parse_line/64k", 200 * scale, parse_line);
+    corpus = saved;
+}
+
+static void single_true(int argc, char **argv)
+{
+    single_exec(argv, -1, -1);
+}
+
+void bench_fork_exec(long scale)
+{
+    long ops = 500 * scale;
+    long start = now_ns();
+    for (long i = 0; i < ops; i++)
+        run_line("true\n", single_true);
+    report("fork_exec", ops, now_ns() - start, "");
+}
+
+void bench_spawn_exec(long scale)
+{
+    char *argv[] = {"true", NULL};
+    long ops = 500 * scale;
+    long start = now_ns();
+    pid_t pid;
+    for (long i = 0; i < ops; i++) {
+        if ((pid = spawn_exec(argv, -1, -1, -1, NULL, 0)) > 0)
+            waitpid(pid, NULL, 0);
+    }
+    report("spawn_exec", ops, now_ns() - start, "");
+}
+
+static void pipeline(int argc, char **argv)
+{
+    int *pos = alloc_arena(cmd_arena, (argc + 1) * sizeof(int));
+    pipe_exec(argv, pos, parse_pipe(argc, argv, pos));
+}
+
+/* bench_pipeline - PIPE_BYTES through pipelines of 2, 4 and 8 stages */
+void bench_pipeline(long scale)
+{
+    char cmdline[MAXLINE];
+    char name[32], extra[64];
+    long bytes = PIPE_BYTES * scale;
+    for (int stages = 2; stages <= 8; stages *= 2) {
+        int n = sprintf(cmdline, "head -c %ld /dev/zero", bytes);
+        for (int i = 0; i < stages - 2; i++)
+            n += sprintf(cmdline + n, " | cat");
+        sprintf(cmdline + n, " | cat > /dev/null\n");
+        long start = now_ns();
+        run_line(cmdline, pipeline);
+        long ns = now_ns() - start;
+        sprintf(name, "pipe_exec/%d", stages);
+        sprintf(extra, "%.1f MB/s", bytes * 1e3 / ns);
+        report(name, 1, ns, extra);
+    }
+}
+
+static void substitution(int argc, char **argv)
+{
+    subs_exec(argc, argv);
+}
+
+void bench_subs_exec(long scale)
+{
+    long ops = 200 * scale;
+    long start = now_ns();
+    for (long i = 0; i < ops; i++)
+        run_line("true <(true) <(true) >(true)\n", substitution);
+    report("subs_exec/3", ops, now_ns() - start, "");
+}
+
+/*
+ * bench_linked_ht - put, get, miss, list and remove at 10^3 to 10^6 keys
+ *     (10^6 only with -s 10 or more), with bookmark-like keys made up front
+ */
+void bench_linked_ht(long scale)
+{
+    long max = scale >= 10 ? 1000000 : 100000;
+    char (*keys)[32] = malloc(max * sizeof(*keys));
+    char (*missing)[32] = malloc(max * sizeof(*missing));
+    hkey_t *all_keys = malloc(max * sizeof(hkey_t));
+    value_t *all_values = malloc(max * sizeof(value_t));
+    char name[40];
+    long start;
+
+    if (keys == NULL || missing == NULL || all_keys == NULL || all_values == NULL)
+        app_error("out of space!!");
+    for (long i = 0; i < max; i++) {
+        sprintf(keys[i], "bookmark%ld", i);
+        sprintf(missing[i], "missing%ld", i);
+    }
+    for (long n = 1000; n <= max; n *= 10) {
+        long rounds = 1000000 / n;
+        linked_ht t = create_linked_ht();
+        start = now_ns();
+        for (long i = 0; i < n; i++)
+            put_linked_ht(t, keys[i], "/home/user/projects/tsh");
+        sprintf(name, "linked_ht/put/%ld", n);
+        report(name, n, now_ns() - start, "");
+
+        start = now_ns();
+        for (long r = 0; r < rounds; r++) {
+            for (long i = 0; i < n; i++) {
+                if (get_linked_ht(t, keys[i]) == NULL)
+                    app_error("linked_ht: lost a key");
+            }
+        }
+        sprintf(name, "linked_ht/get/%ld", n);
+        report(name, rounds * n, now_ns() - start, "");
+
+        start = now_ns();
+        for (long i = 0; i < n; i++) {
+            if (get_linked_ht(t, missing[i]) != NULL)
+                app_error("linked_ht: found a missing key");
+        }
+        sprintf(name, "linked_ht/miss/%ld", n);
+        report(name, n, now_ns() - start, "");
+
+        start = now_ns();
+        for (long r = 0; r < rounds; r++)
+            get_all_linked_ht_data(t, all_keys, all_values, (int) n);
+        sprintf(name, "linked_ht/list/%ld", n);
+        report(name, rounds * n, now_ns() - start, "");
+
+        start = now_ns();
+        for (long i = 0; i < n; i++)
+            remove_linked_ht(t, keys[i]);
+        sprintf(name, "linked_ht/remove/%ld", n);
+        report(name, n, now_ns() - start, "");
+        dispose_linked_ht(t);
+    }
+    free(keys);
+    free(missing);
+    free(all_keys);
+    free(all_values);
+}
+
+/* bench_jobs - add, look up and delete 4096 jobs at a time */
+void bench_jobs(long scale)
+{
+    const int batch = 4096;
+    long rounds = 20 * scale;
+    long start = now_ns();
+    for (long r = 0; r < rounds; r++) {
+        for (pid_t pid = 1; pid <= batch; pid++)
+            addjob(jobs, pid, BG, "sleep 10 &\n");
+        for (pid_t pid = 1; pid <= batch; pid++)
+            if (getjobjid(jobs, pid2jid(pid)) == NULL)
+                app_error("jobs: lost a job");
+        for (pid_t pid = 1; pid <= batch; pid++)
+            deletejob(jobs, pid);
+    }
+    report("jobs/add+find+delete", rounds * batch, now_ns() - start, "");
+}
+
+struct pid_time
+{
+    long pid;
+    long t;
+};
+
+static int by_pid(const void *a, const void *b)
+{
+    const struct pid_time *x = a, *y = b;
+    return x->pid < y->pid ? -1 : x->pid > y->pid;
+}
+
+static int by_time(const void *a, const void *b)
+{
+    long x = *(const long *) a, y = *(const long *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* trace_field - The number after key in a trace event, or -1 */
+static long trace_field(const char *event, const char *key)
+{
+    const char *p = strstr(event, key);
+    return p != NULL ? atol(p + strlen(key)) : -1;
+}
+
+/* run_tsh - Run the tsh binary with args (ending in NULL), and return how long it took */
+static long run_tsh(char **args, int out_fd)
+{
+    long start = now_ns();
+    pid_t pid;
+    if ((pid = fork()) == 0) {
+        dup2(out_fd, STDOUT_FILENO);
+        dup2(out_fd, STDERR_FILENO);
+        execv(TSH_PATH, args);
+        _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+    return now_ns() - start;
+}
+
+/* bench_shell_lines - SHELL_LINES script lines run by the tsh binary, one after another */
+void bench_shell_lines(long scale)
+{
+    static const char *lines[] = {"/bin/true", "/bin/true | /bin/true", "/bin/true | /bin/true | /bin/true"};
+    char script[] = "/tmp/tsh_benchXXXXXX";
+    char name[32], extra[32];
+    long n = SHELL_LINES * scale, ns;
+    int fd, null_fd;
+    FILE *fp = NULL;
+
+    if ((null_fd = open("/dev/null", O_WRONLY)) < 0)
+        unix_error("bench_shell_lines: open failed");
+    for (int k = 0; k < 3; k++) {
+        if ((fd = mkstemp(script)) < 0 || (fp = fdopen(fd, "w")) == NULL)
+            unix_error("bench_shell_lines: mkstemp failed");
+        for (long i = 0; i < n; i++)
+            fprintf(fp, "%s\n", lines[k]);
+        fclose(fp);
+        ns = run_tsh((char *[]) {"tsh", "-q", script, NULL}, null_fd);
+        sprintf(name, "shell_lines/%d", k + 1);
+        sprintf(extra, "%.0f lines/s", n * 1e9 / ns);
+        report(name, n, ns, extra);
+        unlink(script);
+        strcpy(script, "/tmp/tsh_benchXXXXXX");
+    }
+    close(null_fd);
+}
+
+/*
+ * bench_builtin_scripts - A short script of the lines scripts are made
+ *     of (echo, printf, test, [, pwd, true) run SCRIPT_RUNS times by the
+ *     tsh binary, with those run in the shell and then launched (-B).
+ */
+void bench_builtin_scripts(long scale)
+{
+    static const char *lines[] = {
+        "echo building target",
+        "test -d /tmp",
+        "[ 3 -gt 2 ]",
+        "printf '%s: %d files\\n' src 42",
+        "pwd",
+        "echo step done > /dev/null",
+        "true",
+        "[ -n nonempty ]",
+        NULL
+    };
+    char script[] = "/tmp/tsh_benchXXXXXX";
+    char extra[32];
+    long runs = SCRIPT_RUNS * scale, ns;
+    int fd, null_fd = -1;
+    FILE *fp = NULL;
+
+    if ((fd = mkstemp(script)) < 0 || (fp = fdopen(fd, "w")) == NULL ||
+        (null_fd = open("/dev/null", O_WRONLY)) < 0)
+        unix_error("bench_builtin_scripts: mkstemp failed");
+    for (int k = 0; k < 4; k++) {
+        for (int i = 0; lines[i] != NULL; i++)
+            fprintf(fp, "%s\n", lines[i]);
+    }
+    fclose(fp);
+    for (int fast = 1; fast >= 0; fast--) {
+        ns = 0;
+        for (long i = 0; i < runs; i++) {
+            if (fast)
+                ns += run_tsh((char *[]) {"tsh", "-q", script, NULL}, null_fd);
+            else
+                ns += run_tsh((char *[]) {"tsh", "-B", "-q", script, NULL}, null_fd);
+        }
+        sprintf(extra, "%.1f scripts/s", runs * 1e9 / ns);
+        report(fast ? "scripts/builtin" : "scripts/external", runs, ns, extra);
+    }
+    close(null_fd);
+    unlink(script);
+}
+
+/*
+ * bench_bg_jobs - BG_JOBS short background jobs started by the tsh
+ *     binary, then wait: checks every one was reaped, and reports how
+ *     long each took from fork to reaping, from the shell's own trace.
+ */
+void bench_bg_jobs(long scale)
+{
+    char script[] = "/tmp/tsh_benchXXXXXX";
+    char trace[] = "/tmp/tsh_benchXXXXXX";
+    char out[] = "/tmp/tsh_benchXXXXXX";
+    char line[MAXLINE], extra[96];
+    long n = BG_JOBS * scale, ns, lost = 0;
+    long nforks = 0, nexits = 0, nlat = 0;
+    struct pid_time *forks, *exits = NULL;
+    long *lat;
+    int fd, out_fd = -1, trace_fd = -1;
+    FILE *fp = NULL;
+
+    if ((fd = mkstemp(script)) < 0 || (fp = fdopen(fd, "w")) == NULL ||
+        (trace_fd = mkstemp(trace)) < 0 || (out_fd = mkstemp(out)) < 0)
+        unix_error("bench_bg_jobs: mkstemp failed");
+    for (long i = 0; i < n; i++)
+        fprintf(fp, "/bin/true &\n");
+    fprintf(fp, "wait\njobs\n");
+    fclose(fp);
+    close(trace_fd);
+
+    ns = run_tsh((char *[]) {"tsh", "-q", "-T", trace, script, NULL}, out_fd);
+
+    /* jobs after wait lists any job the shell lost track of */
+    if ((fp = fopen(out, "r")) == NULL)
+        unix_error("bench_bg_jobs: fopen failed");
+    while (fgets(line, sizeof(line), fp) != NULL)
+        lost += strstr(line, ") Running") != NULL;
+    fclose(fp);
+
+    if ((forks = malloc(n * sizeof(*forks))) == NULL || (exits = malloc(n * sizeof(*exits))) == NULL ||
+        (lat = malloc(n * sizeof(long))) == NULL)
+        app_error("out of space!!");
+    if ((fp = fopen(trace, "r")) == NULL)
+        unix_error("bench_bg_jobs: fopen failed");
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (!strncmp(line, "{\"ev\":\"cmd\"", 11) && nforks < n)
+            forks[nforks++] = (struct pid_time) {trace_field(line, ",\"pid\":"), trace_field(line, "\"t_fork\":")};
+        else if (!strncmp(line, "{\"ev\":\"exit\"", 12) && nexits < n)
+            exits[nexits++] = (struct pid_time) {trace_field(line, ",\"pid\":"), trace_field(line, "\"t\":")};
+    }
+    fclose(fp);
+    qsort(forks, nforks, sizeof(*forks), by_pid);
+    qsort(exits, nexits, sizeof(*exits), by_pid);
+    for (long i = 0, j = 0; i < nforks && j < nexits;) {
+        if (forks[i].pid == exits[j].pid)
+            lat[nlat++] = exits[j++].t - forks[i++].t;
+        else if (forks[i].pid < exits[j].pid)
+            i++;
+        else
+            j++;
+    }
+    lost += n - nlat;
+    qsort(lat, nlat, sizeof(long), by_time);
+    sprintf(extra, "fork->reap p50 %ldus p99 %ldus max %ldus, %ld lost",
+            nlat > 0 ? lat[nlat / 2] : 0, nlat > 0 ? lat[nlat * 99 / 100] : 0,
+            nlat > 0 ? lat[nlat - 1] : 0, lost);
+    report("bg_jobs/true&", n, ns, extra);
+    if (lost > 0)
+        app_error("bg_jobs: lost jobs");
+
+    free(forks);
+    free(exits);
+    free(lat);
+    unlink(script);
+    unlink(trace);
+    unlink(out);
+    close(out_fd);
+}
+
+/* read_lines - Read every line of a script, returns the bytes read */
+static long read_lines(script sp)
+{
+    char *line;
+    long bytes = 0;
+    while ((line = read_script_line(sp)) != NULL)
+        bytes += strlen(line);
+    close_script(sp);
+    return bytes;
+}
+
+/* bench_script_read - SCRIPT_LINES lines read with fgets, mapped and streamed */
+void bench_script_read(long scale)
+{
+    char filename[] = "/tmp/tsh_benchXXXXXX";
+    char line[MAXLINE], name[32], extra[64];
+    long lines = SCRIPT_LINES * scale, bytes = 0, start, ns;
+    int fd, fds[2];
+    pid_t pid;
+    FILE *fp;
+
+    if ((fd = mkstemp(filename)) < 0 || (fp = fdopen(fd, "w")) == NULL)
+        unix_error("bench_script_read: mkstemp failed");
+    for (long i = 0; i < lines; i++)
+        fprintf(fp, "cp -p build/obj/f%ld.o /srv/nightly/artifacts/obj/ &\n", i);
+    fclose(fp);
+
+    /* what main did before */
+    start = now_ns();
+    if ((fp = fopen(filename, "r")) == NULL)
+        unix_error("bench_script_read: fopen failed");
+    while (fgets(line, MAXLINE, fp) != NULL)
+        bytes += strlen(line);
+    fclose(fp);
+    ns = now_ns() - start;
+    sprintf(extra, "%.1f MB/s", bytes * 1e3 / ns);
+    report("script_read/fgets", lines, ns, extra);
+
+    start = now_ns();
+    bytes = read_lines(open_script(filename));
+    ns = now_ns() - start;
+    sprintf(extra, "%.1f MB/s", bytes * 1e3 / ns);
+    report("script_read/mmap", lines, ns, extra);
+
+    /* the same script through a pipe, as from a generator */
+    if (pipe(fds) < 0)
+        unix_error("bench_script_read: pipe failed");
+    start = now_ns();
+    if ((pid = fork()) == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execlp("cat", "cat", filename, (char *) NULL);
+        _exit(1);
+    }
+    close(fds[1]);
+    sprintf(name, "/dev/fd/%d", fds[0]);
+    bytes = read_lines(open_script(name));
+    ns = now_ns() - start;
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    sprintf(extra, "%.1f MB/s", bytes * 1e3 / ns);
+    report("script_read/stream", lines, ns, extra);
+    unlink(filename);
+}
+
+/* search_many - Run ops searches of pattern from the end of the history */
+static void search_many(const char *name, long ops, const char *pattern, int how,
+                        long (*search)(const char *pattern, int how, long before))
+{
+    long start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        if (search(pattern, how, history_count()) < 0)
+            app_error("history_search: lost an entry");
+    }
+    report(name, ops, now_ns() - start, "");
+}
+
+/*
+ * bench_history_search - The newest match in a HISTORY_LINES history,
+ *     with the trigram index and by reading every entry. The patterns
+ *     only match old entries, the slow case for a scan. Searching a
+ *     history of only short entries, before the others are added, is
+ *     checked first.
+ */
+void bench_history_search(long scale)
+{
+    char filename[] = "/tmp/tsh_benchXXXXXX";
+    char idx_name[sizeof(filename) + 4];
+    char line[MAXLINE];
+    long lines = HISTORY_LINES * scale, start;
+    int fd;
+
+    if ((fd = mkstemp(filename)) < 0)
+        unix_error("bench_history_search: mkstemp failed");
+    close(fd);
+    sprintf(idx_name, "%s.idx", filename);
+    if (open_history(filename) < 0)
+        unix_error("bench_history_search: open_history failed");
+    /* entries too short to index: the search has no table to look in */
+    add_history("x\n");
+    if (search_history("abc", MATCH_SUBSTRING, history_count()) >= 0 ||
+        search_history("ab", MATCH_PREFIX, history_count()) >= 0)
+        app_error("history_search: matched an entry too short to match");
+    start = now_ns();
+    for (long i = 0; i < lines; i++) {
+        switch (i % 4) {
+            case 0:
+                sprintf(line, "git commit -am 'fix issue %ld'\n", i);
+                break;
+            case 1:
+                sprintf(line, "make -j8 target%ld\n", i);
+                break;
+            case 2:
+                sprintf(line, "ssh build%ld.example.com uptime\n", i % 1000);
+                break;
+            default:
+                sprintf(line, "cd /srv/nightly/%ld | ls -l\n", i);
+        }
+        add_history(line);
+    }
+    report("history/add", lines, now_ns() - start, "");
+
+    start = now_ns();
+    search_history("", MATCH_PREFIX, 0);    /* builds the index */
+    report("history/index", lines, now_ns() - start, "");
+
+    search_many("history/prefix", 10000 * scale, "git commit -am 'fix issue 4'", MATCH_PREFIX, search_history);
+    search_many("history/prefix/scan", 10 * scale, "git commit -am 'fix issue 4'", MATCH_PREFIX, scan_history);
+    search_many("history/substr", 10000 * scale, "issue 12'", MATCH_SUBSTRING, search_history);
+    search_many("history/substr/scan", 10 * scale, "issue 12'", MATCH_SUBSTRING, scan_history);
+    unlink(filename);
+    unlink(idx_name);
+}
+
+/* complete_many - Complete line ops times, optionally from a cold cache */
+static void complete_many(const char *name, long ops, const char *line, int cold)
+{
+    char **matches;
+    size_t start;
+    long t = now_ns();
+    for (long i = 0; i < ops; i++) {
+        if (cold)
+            clear_completion_cache();
+        if (complete_line(line, strlen(line), &start, &matches, cmd_arena) == 0)
+            app_error("complete: no matches");
+        clear_arena(cmd_arena);
+    }
+    report(name, ops, now_ns() - t, "");
+}
+
+/*
+ * bench_complete - Path completion in a COMPLETE_FILES directory and
+ *     command completion over PATH, reading the directories each time
+ *     and from the inotify-checked cache.
+ */
+void bench_complete(long scale)
+{
+    char dir[] = "/tmp/tsh_benchXXXXXX";
+    char path[64], line[96];
+    long files = COMPLETE_FILES * scale;
+    int fd;
+
+    if (mkdtemp(dir) == NULL)
+        unix_error("bench_complete: mkdtemp failed");
+    for (long i = 0; i < files; i++) {
+        sprintf(path, "%s/file%07ld.txt", dir, i);
+        if ((fd = open(path, O_CREAT | O_WRONLY, 0644)) < 0)
+            unix_error("bench_complete: open failed");
+        close(fd);
+    }
+    sprintf(line, "cat %s/file00012", dir);
+    complete_many("complete/path/cold", 20, line, 1);
+    complete_many("complete/path", 10000 * scale, line, 0);
+    complete_many("complete/command/cold", 20, "gr", 1);
+    complete_many("complete/command", 10000 * scale, "gr", 0);
+
+    /* a new file has to show up: the watch drops the listing */
+    sprintf(path, "%s/new.txt", dir);
+    sprintf(line, "cat %s/new", dir);
+    if ((fd = open(path, O_CREAT | O_WRONLY, 0644)) < 0)
+        unix_error("bench_complete: open failed");
+    close(fd);
+    complete_many("complete/path/changed", 1, line, 0);
+
+    unlink(path);
+    for (long i = 0; i < files; i++) {
+        sprintf(path, "%s/file%07ld.txt", dir, i);
+        unlink(path);
+    }
+    rmdir(dir);
+    clear_completion_cache();
+}
+
+/* legacy_save - What quit did before: rewrite the whole text file */
+static void legacy_save(const char *filename, int n, char **keys, char **values)
+{
+    FILE *fp;
+    if ((fp = fopen(filename, "w")) == NULL)
+        unix_error("legacy_save: fopen failed");
+    for (int i = 0; i < n; i++)
+        fprintf(fp, "%s\n%s\n", keys[i], values[i]);
+    fclose(fp);
+}
+
+/*
+ * bench_bookmarks - BOOKMARKS bookmarks: one addb (a journal append and
+ *     a table change) against rewriting the text file, a lookup in the
+ *     shared table, then compaction and loading.
+ */
+void bench_bookmarks(long scale)
+{
+    char base[] = "/tmp/tsh_benchXXXXXX";
+    char alias[32], path[64], file[64];
+    long n = BOOKMARKS * scale, start;
+    int fd, count;
+    char **keys;
+
+    if ((fd = mkstemp(base)) < 0)
+        unix_error("bench_bookmarks: mkstemp failed");
+    close(fd);
+    load_bookmarks(base);
+    start = now_ns();
+    for (long i = 0; i < n; i++) {
+        sprintf(alias, "proj%ld", i);
+        sprintf(path, "/home/user/src/project%ld", i);
+        add_bookmark(alias, path);
+    }
+    report("bookmarks/addb", n, now_ns() - start, "");
+
+    start = now_ns();
+    for (long i = 0; i < n; i++) {
+        sprintf(alias, "proj%ld", i);
+        if (get_bookmark(alias) == NULL)
+            app_error("bookmarks: lost a bookmark");
+    }
+    report("bookmarks/get", n, now_ns() - start, "");
+
+    keys = bookmark_names(&count, cmd_arena);
+    {
+        char *values[count];
+        for (int i = 0; i < count; i++)
+            values[i] = get_bookmark(keys[i]);
+        start = now_ns();
+        for (int i = 0; i < 10; i++)
+            legacy_save(base, count, keys, values);
+        report("bookmarks/save/legacy", 10, now_ns() - start, "");
+    }
+    clear_arena(cmd_arena);
+
+    start = now_ns();
+    save_bookmarks();
+    report("bookmarks/compact", 1, now_ns() - start, "");
+
+    start = now_ns();
+    for (int i = 0; i < 10; i++)
+        load_bookmarks(base);
+    report("bookmarks/load", 10, now_ns() - start, "");
+    if (get_bookmark("proj0") == NULL)
+        app_error("bookmarks: lost a bookmark");
+
+    unlink(base);
+    sprintf(file, "%s.snap", base);
+    unlink(file);
+    sprintf(file, "%s.journal", base);
+    unlink(file);
+    sprintf(file, "%s.table", base);
+    unlink(file);
+}
+
+/*
+ * bench_frecency - JUMP_DIRS visited directories, then cdb queries against
+ *     them: a whole component, a prefix, a subsequence and a miss.
+ */
+void bench_frecency(long scale)
+{
+    static const char *parts[] = {"src", "build", "docs", "tests", "lib", "include", "tools", "web"};
+    static const char *queries[] = {"project4711", "proj12", "pjt47", "qqzz"};
+    char path[128];
+    long n = JUMP_DIRS * scale, start;
+    time_t now = time(NULL);
+    int fd;
+
+    if ((fd = open("/dev/null", O_WRONLY)) < 0)
+        unix_error("bench_frecency: open failed");
+    start = now_ns();
+    for (long i = 0; i < n; i++) {
+        sprintf(path, "/home/user/%s/project%ld/%s", parts[i % 8], i / 8, parts[(i / 8) % 8]);
+        add_dir(path, 1 + i % 7, now - i * 60);
+    }
+    report("frecency/add", n, now_ns() - start, "");
+    for (int q = 0; q < 4; q++) {
+        char name[64];
+        int found = 0;
+        sprintf(name, "frecency/query/%s", queries[q]);
+        start = now_ns();
+        for (int i = 0; i < 100; i++)
+            found = list_jumps(fd, queries[q], 10);
+        report(name, 100, now_ns() - start, found > 0 ? "" : "(no match)");
+    }
+    close(fd);
+}
+
+static const struct benchmark benchmarks[] = {
+    {"parse_line", bench_parse_line},
+    {"fork_exec",  bench_fork_exec},
+    {"spawn_exec", bench_spawn_exec},
+    {"pipe_exec",  bench_pipeline},
+    {"subs_exec",  bench_subs_exec},
+    {"linked_ht",  bench_linked_ht},
+    {"jobs",       bench_jobs},
+    {"bg_jobs",    bench_bg_jobs},
+    {"shell_lines", bench_shell_lines},
+    {"scripts",    bench_builtin_scripts},
+    {"script_read", bench_script_read},
+    {"history_search", bench_history_search},
+    {"complete", bench_complete},
+    {"frecency", bench_frecency},
+    {"bookmarks", bench_bookmarks},
+    {NULL, NULL}
+};
+
+/* selected - Returns true if name was asked for (no names means all) */
+static int selected(const char *name, int argc, char **argv)
+{
+    if (optind == argc)
+        return 1;
+    for (int i = optind; i < argc; i++)
+        if (!strcmp(argv[i], name))
+            return 1;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    long scale = 1;
+    int c;
+
+    while ((c = getopt(argc, argv, "s:c:")) != -1) {
+        switch (c) {
+            case 's':
+                scale = atol(optarg) > 0 ? atol(optarg) : 1;
+                break;
+            case 'c':
+                load_corpus(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: tsh_bench [-s scale] [-c corpus] [benchmark...]\n");
+                exit(1);
+        }
+    }
+    initjobs(jobs);
+    cmd_arena = create_arena(0);
+    for (int i = 0; benchmarks[i].name != NULL; i++)
+        if (selected(benchmarks[i].name, argc, argv))
+            benchmarks[i].func(scale);
+    return 0;
+}
@@ -1,39 +1,413 @@
 #include <pwd.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sched.h>
 #include "bookmark.h"
 #include "errmsg.h"
-#include "linked_hash_table.h"
 
 #define BUFSIZE 1024
+#define PATHSIZE 4096
 
-linked_ht bookmarks;
+#define SNAP_MAGIC     0x42485354u  /* "TSHB" */
+#define SNAP_VERSION   1
+#define TABLE_MAGIC    0x54485354u  /* "TSHT" */
+#define TABLE_VERSION  1
+#define RECORD_HEADER  13           /* check, op, alias and path lengths */
+#define COMPACT_BYTES  (64 << 10)   /* journal size that asks for compaction */
+#define INIT_SLOTS     64           /* table slots, a power of two */
+#define INIT_STRINGS   4096         /* table string bytes */
+#define SPIN_TRIES     1000         /* reads retried before a writer is taken for dead */
+
+#define OP_ADD    'A'
+#define OP_REMOVE 'R'
+
+/* table slot values besides entry + 1 */
+#define SLOT_EMPTY   0
+#define SLOT_REMOVED UINT32_MAX
 
 static const char *default_file = ".tshinfo";
 
+/*
+ * The bookmarks are kept in three files next to the old text file:
+ *
+ *   <file>.snap     a snapshot: a header, then (alias, path) offset pairs
+ *                   into a block of NUL-terminated strings, oldest first.
+ *   <file>.journal  add and remove records appended since the snapshot,
+ *                   each with a checksum, so a torn last record is found
+ *                   and cut off.
+ *   <file>.table    the live table, mapped shared by every session.
+ *
+ * The snapshot and the journal are what's durable; the table is what's
+ * read. It's an open-addressing index of entries in insertion order, with
+ * their strings in an append-only block, and it's rebuilt from the other
+ * two when it's missing, damaged or behind the journal.
+ *
+ * A writer (addb, rmb) holds flock on the journal, appends its record,
+ * then changes the table under a sequence count: odd while a change is
+ * under way. Readers (cdb, lsb, completion) take no lock: they read the
+ * count, look, and look again if the count moved, so every session sees
+ * a change as soon as it's made. A table that's full is copied into a
+ * bigger file renamed over it, and the old one is marked moved so readers
+ * map the new one. Strings are never overwritten in a table, and a table
+ * that's been replaced stays mapped, so a string returned before stays
+ * good. A count left odd by a writer that died is found by the next one
+ * to take the lock, which rebuilds the table.
+ *
+ * Compaction writes the table to a new snapshot, renamed over the old
+ * one, and empties the journal. The old text file is imported once, if
+ * there's nothing else.
+ */
+struct snap_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t strings;       /* offset of the string block */
+};
+
+struct snap_entry
+{
+    uint32_t alias;         /* offsets in the string block */
+    uint32_t path;
+};
+
+struct table_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;           /* odd while a writer is changing the table */
+    uint32_t moved;         /* replaced by a new table file */
+    uint32_t nslots;        /* the sizes are fixed for a file */
+    uint32_t entries_cap;
+    uint32_t strings_cap;
+    uint32_t used;          /* entries, removed ones included */
+    uint32_t live;
+    uint32_t removed;       /* SLOT_REMOVED slots */
+    uint32_t strings_used;
+    uint32_t pad;
+    uint64_t journal_size;  /* the journal the table has caught up with */
+};
+
+struct table_entry
+{
+    uint32_t hash;
+    uint32_t alias;         /* offsets in the strings */
+    uint32_t path;          /* 0 once removed */
+};
+
+/* table - A mapping of a table */
+struct table
+{
+    char *map;
+    size_t size;
+    struct table_header *h;
+    uint32_t *slots;
+    struct table_entry *entries;
+    char *strings;
+};
+
+static struct table cur;
+static char text_file[PATHSIZE];
+static char snap_file[PATHSIZE];
+static char journal_file[PATHSIZE];
+static char table_file[PATHSIZE];
+static int journal_fd = -1;
+
 const char *get_home_dir()
 {
-    struct passwd *pw = getpwuid(getuid());
+    const char *home = getenv("HOME");
+    struct passwd *pw;
+    if (home != NULL && home[0] != '\0') {
+        return home;
+    }
+    pw = getpwuid(getuid());
     return pw->pw_dir;
 }
 
-int load_bookmarks(char *filename)
+/* fnv32 - FNV-1a, the record checksum and the table hash */
+static uint32_t fnv32(const char *p, size_t n)
+{
+    uint32_t h = 2166136261u;
+    while (n-- > 0) {
+        h = (h ^ (unsigned char) *p++) * 16777619u;
+    }
+    return h;
+}
+
+static size_t table_size(uint32_t nslots, uint32_t entries_cap, uint32_t strings_cap)
+{
+    return sizeof(struct table_header) + nslots * sizeof(uint32_t) +
+           entries_cap * sizeof(struct table_entry) + strings_cap;
+}
+
+/* set_table - Point t's parts into its mapping; returns -1 if it isn't a table */
+static int set_table(struct table *t)
+{
+    struct table_header *h = (struct table_header *) t->map;
+    if (t->size < sizeof(*h) || h->magic != TABLE_MAGIC || h->version != TABLE_VERSION ||
+        h->nslots == 0 || (h->nslots & (h->nslots - 1)) != 0 || h->strings_cap == 0 ||
+        table_size(h->nslots, h->entries_cap, h->strings_cap) != t->size ||
+        t->map[t->size - 1] != '\0') {
+        return -1;
+    }
+    t->h = h;
+    t->slots = (uint32_t *) (h + 1);
+    t->entries = (struct table_entry *) (t->slots + h->nslots);
+    t->strings = (char *) (t->entries + h->entries_cap);
+    return 0;
+}
+
+/*
+ * create_table - Map a new, empty table with the given sizes, in the
+ *     table file's temporary (or in memory, without a journal). It's
+ *     made with its count odd, as it's filled before anyone reads it.
+ */
+static int create_table(struct table *t, uint32_t nslots, uint32_t entries_cap, uint32_t strings_cap)
+{
+    char tmp[PATHSIZE + 8];
+    int fd = -1;
+
+    t->size = table_size(nslots, entries_cap, strings_cap);
+    if (journal_fd >= 0) {
+        snprintf(tmp, sizeof(tmp), "%s.tmp", table_file);
+        if ((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0 ||
+            ftruncate(fd, t->size) < 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+        t->map = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    } else {
+        t->map = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    }
+    if (t->map == MAP_FAILED) {
+        return -1;
+    }
+    t->h = (struct table_header *) t->map;
+    *t->h = (struct table_header) {TABLE_MAGIC, TABLE_VERSION, 1, 0, nslots, entries_cap, strings_cap,
+                                   0, 0, 0, 1, 0, 0};
+    set_table(t);
+    return 0;
+}
+
+/* begin_write - Make the count odd: readers wait until the change is made */
+static void begin_write(struct table *t)
+{
+    __atomic_store_n(&t->h->seq, t->h->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/* end_write - Make the count even again, with the change visible before it */
+static void end_write(struct table *t)
+{
+    __atomic_store_n(&t->h->seq, t->h->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * install - Put a new table in place of the current one, which is marked
+ *     moved for the sessions still reading it; writing tells whether the
+ *     current one is in the middle of a change.
+ */
+static void install(struct table *t, int writing)
+{
+    char tmp[PATHSIZE + 8];
+    if (journal_fd >= 0) {
+        snprintf(tmp, sizeof(tmp), "%s.tmp", table_file);
+        rename(tmp, table_file);
+    }
+    if (cur.h != NULL) {
+        if (!writing) {
+            begin_write(&cur);
+        }
+        cur.h->moved = 1;
+        end_write(&cur);
+    }
+    /* the old mapping stays: strings handed out may point into it */
+    cur = *t;
+}
+
+/* map_table - Map the table file as it is now; returns -1 if it isn't one */
+static int map_table(void)
+{
+    struct table t;
+    struct stat sb;
+    int fd;
+    if ((fd = open(table_file, O_RDWR | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &sb) < 0 || sb.st_size == 0 ||
+        (t.map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    t.size = sb.st_size;
+    if (set_table(&t) < 0) {
+        munmap(t.map, t.size);
+        return -1;
+    }
+    cur = t;
+    return 0;
+}
+
+/*
+ * find_slot - Returns the slot of alias in t, or -1. Readers call it
+ *     without the lock, so everything read is bounded, and the result is
+ *     only good if the count didn't move.
+ */
+static long find_slot(struct table *t, const char *alias, uint32_t hash)
+{
+    uint32_t mask = t->h->nslots - 1;
+    uint32_t s = hash & mask;
+    for (uint32_t n = 0; n < t->h->nslots; n++, s = (s + 1) & mask) {
+        uint32_t e = t->slots[s];
+        struct table_entry *entry;
+        if (e == SLOT_EMPTY) {
+            break;
+        }
+        if (e == SLOT_REMOVED || e > t->h->entries_cap) {
+            continue;
+        }
+        entry = &t->entries[e - 1];
+        if (entry->hash == hash && entry->alias < t->h->strings_cap &&
+            strcmp(t->strings + entry->alias, alias) == 0) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+/* add_string - Copy s into t's strings; returns its offset */
+static uint32_t add_string(struct table *t, const char *s)
+{
+    uint32_t off = t->h->strings_used;
+    size_t n = strlen(s) + 1;
+    memcpy(t->strings + off, s, n);
+    t->h->strings_used += n;
+    return off;
+}
+
+/*
+ * grow - Copy the live entries into a new table with room for one more
+ *     and extra string bytes, and put it in place. Called in a change.
+ */
+static int grow(size_t extra)
+{
+    struct table t;
+    size_t strings = 1 + extra;
+    uint32_t nslots = INIT_SLOTS, entries_cap, strings_cap = INIT_STRINGS;
+    uint32_t live = cur.h->live + 1;
+
+    for (uint32_t i = 0; i < cur.h->used; i++) {
+        if (cur.entries[i].path != 0) {
+            strings += strlen(cur.strings + cur.entries[i].alias) +
+                       strlen(cur.strings + cur.entries[i].path) + 2;
+        }
+    }
+    while (4 * live > nslots) {
+        nslots *= 2;
+    }
+    entries_cap = nslots / 2;
+    while (strings_cap < 2 * strings) {
+        strings_cap *= 2;
+    }
+    if (create_table(&t, nslots, entries_cap, strings_cap) < 0) {
+        app_error("out of space!!");
+        return -1;
+    }
+    for (uint32_t i = 0; i < cur.h->used; i++) {
+        struct table_entry *e = &cur.entries[i];
+        uint32_t s, n;
+        if (e->path == 0) {
+            continue;
+        }
+        n = t.h->used++;
+        t.entries[n].hash = e->hash;
+        t.entries[n].alias = add_string(&t, cur.strings + e->alias);
+        t.entries[n].path = add_string(&t, cur.strings + e->path);
+        for (s = e->hash & (nslots - 1); t.slots[s] != SLOT_EMPTY; s = (s + 1) & (nslots - 1)) {
+        }
+        t.slots[s] = n + 1;
+        t.h->live++;
+    }
+    t.h->journal_size = cur.h->journal_size;
+    install(&t, 1);
+    return 0;
+}
+
+/* table_put - Set alias to path in the table. Called in a change. */
+static int table_put(const char *alias, const char *path)
 {
-    if (bookmarks == NULL) {
-        if ((bookmarks = create_linked_ht()) == NULL) {
+    uint32_t hash = fnv32(alias, strlen(alias));
+    size_t need = strlen(alias) + strlen(path) + 2;
+    long s = find_slot(&cur, alias, hash);
+    uint32_t n;
+
+    if (s >= 0) {
+        struct table_entry *e = &cur.entries[cur.slots[s] - 1];
+        if (strcmp(cur.strings + e->path, path) == 0) {
+            return 0;
+        }
+        if (cur.h->strings_used + need + 1 > cur.h->strings_cap && grow(need) < 0) {
+            return -1;
+        }
+        /* the same entry, in the table it may have moved to */
+        s = find_slot(&cur, alias, hash);
+        cur.entries[cur.slots[s] - 1].path = add_string(&cur, path);
+        return 0;
+    }
+    if (cur.h->used == cur.h->entries_cap || 4 * (cur.h->live + cur.h->removed + 1) > 3 * cur.h->nslots ||
+        cur.h->strings_used + need + 1 > cur.h->strings_cap) {
+        if (grow(need) < 0) {
             return -1;
         }
     }
+    n = cur.h->used;
+    cur.entries[n].hash = hash;
+    cur.entries[n].alias = add_string(&cur, alias);
+    cur.entries[n].path = add_string(&cur, path);
+    cur.h->used++;
+    cur.h->live++;
+    for (s = hash & (cur.h->nslots - 1); cur.slots[s] != SLOT_EMPTY && cur.slots[s] != SLOT_REMOVED;
+         s = (s + 1) & (cur.h->nslots - 1)) {
+    }
+    if (cur.slots[s] == SLOT_REMOVED) {
+        cur.h->removed--;
+    }
+    cur.slots[s] = n + 1;
+    return 0;
+}
+
+/* table_remove - Remove alias from the table. Called in a change. */
+static int table_remove(const char *alias)
+{
+    long s = find_slot(&cur, alias, fnv32(alias, strlen(alias)));
+    if (s < 0) {
+        return -1;
+    }
+    cur.entries[cur.slots[s] - 1].path = 0;
+    cur.slots[s] = SLOT_REMOVED;
+    cur.h->live--;
+    cur.h->removed++;
+    return 0;
+}
+
+/* load_text - Import the old alternating alias/path text file */
+static int load_text(const char *filename)
+{
     FILE *fp;
     char buf[BUFSIZE];
-    char filebuf[BUFSIZE];
     char alias[BUFSIZE];
     size_t count;
-    if (!filename) {
-        filename = filebuf;
-        sprintf(filename, "%s/%s", get_home_dir(), default_file);
-    }
     if ((fp = fopen(filename, "r")) == NULL) {
         return 0;
     }
@@ -46,73 +420,423 @@ int load_bookmarks(char *filename)
             if (strlen(buf) != 0) {
                 if (buf[0] != '/') {
                     strcpy(alias, buf);
-                } else if (put_linked_ht(bookmarks, alias, buf) < 0) {
+                } else if (table_put(alias, buf) < 0) {
+                    fclose(fp);
                     return -1;
                 }
             }
         }
     }
     fclose(fp);
+    return 1;
+}
+
+/* load_snapshot - Put the snapshot's bookmarks in the table */
+static int load_snapshot(void)
+{
+    struct stat sb;
+    const struct snap_header *h;
+    const struct snap_entry *e;
+    const char *strings;
+    char *map;
+    int fd;
+    if ((fd = open(snap_file, O_RDONLY | O_CLOEXEC)) < 0) {
+        return 0;
+    }
+    if (fstat(fd, &sb) < 0 || sb.st_size < (off_t) sizeof(struct snap_header) ||
+        (map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    h = (const struct snap_header *) map;
+    e = (const struct snap_entry *) (h + 1);
+    strings = map + h->strings;
+    if (h->magic != SNAP_MAGIC || h->version != SNAP_VERSION || h->strings > sb.st_size ||
+        sizeof(*h) + (size_t) h->count * sizeof(*e) > h->strings || map[sb.st_size - 1] != '\0') {
+        munmap(map, sb.st_size);
+        return -1;
+    }
+    for (uint32_t i = 0; i < h->count; i++) {
+        if (e[i].alias >= sb.st_size - h->strings || e[i].path >= sb.st_size - h->strings) {
+            break;
+        }
+        table_put(strings + e[i].alias, strings + e[i].path);
+    }
+    munmap(map, sb.st_size);
+    return 1;
+}
+
+/*
+ * replay_journal - Apply the journal's records to the table, and cut
+ *     off a torn or corrupt tail. Called with the journal locked.
+ */
+static void replay_journal(void)
+{
+    struct stat sb;
+    char *map;
+    uint32_t check, alias_len, path_len;
+    size_t off = 0;
+    if (fstat(journal_fd, &sb) < 0 || sb.st_size == 0) {
+        return;
+    }
+    if ((map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, journal_fd, 0)) == MAP_FAILED) {
+        return;
+    }
+    while (off + RECORD_HEADER <= (size_t) sb.st_size) {
+        const char *r = map + off;
+        memcpy(&check, r, 4);
+        memcpy(&alias_len, r + 5, 4);
+        memcpy(&path_len, r + 9, 4);
+        if (alias_len > PATHSIZE || path_len > PATHSIZE ||
+            off + RECORD_HEADER + alias_len + path_len > (size_t) sb.st_size ||
+            fnv32(r + 4, RECORD_HEADER - 4 + alias_len + path_len) != check) {
+            break;
+        }
+        {
+            char alias[alias_len + 1];
+            char path[path_len + 1];
+            memcpy(alias, r + RECORD_HEADER, alias_len);
+            alias[alias_len] = '\0';
+            memcpy(path, r + RECORD_HEADER + alias_len, path_len);
+            path[path_len] = '\0';
+            if (r[4] == OP_ADD) {
+                table_put(alias, path);
+            } else {
+                table_remove(alias);
+            }
+        }
+        off += RECORD_HEADER + alias_len + path_len;
+    }
+    munmap(map, sb.st_size);
+    if (off < (size_t) sb.st_size) {
+        ftruncate(journal_fd, off);
+    }
+}
+
+/* journal_size - The journal's length now */
+static uint64_t journal_size(void)
+{
+    struct stat sb;
+    return journal_fd >= 0 && fstat(journal_fd, &sb) == 0 ? (uint64_t) sb.st_size : 0;
+}
+
+/*
+ * write_snapshot - Write the table to the snapshot and empty the journal.
+ *     Called with the journal locked.
+ */
+static int write_snapshot(void)
+{
+    struct snap_header h = {SNAP_MAGIC, SNAP_VERSION, cur.h->live, 0};
+    struct snap_entry *entries;
+    char tmp[PATHSIZE + 8];
+    char *block, *p;
+    int fd, ok, n = 0;
+
+    h.strings = sizeof(h) + h.count * sizeof(struct snap_entry);
+    if ((block = malloc(h.strings + cur.h->strings_used + 1)) == NULL) {
+        app_error("out of space!!");
+        return -1;
+    }
+    memcpy(block, &h, sizeof(h));
+    entries = (struct snap_entry *) (block + sizeof(h));
+    p = block + h.strings;
+    /* oldest first, so loading it puts them back in the same order */
+    for (uint32_t i = 0; i < cur.h->used; i++) {
+        if (cur.entries[i].path == 0) {
+            continue;
+        }
+        entries[n].alias = p - (block + h.strings);
+        p = stpcpy(p, cur.strings + cur.entries[i].alias) + 1;
+        entries[n++].path = p - (block + h.strings);
+        p = stpcpy(p, cur.strings + cur.entries[i].path) + 1;
+    }
+    *p++ = '\0';    /* an empty table still ends in a NUL */
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", snap_file);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0) {
+        free(block);
+        return -1;
+    }
+    ok = write(fd, block, p - block) == p - block && fdatasync(fd) == 0;
+    close(fd);
+    free(block);
+    if (!ok || rename(tmp, snap_file) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    if (journal_fd >= 0 && ftruncate(journal_fd, 0) < 0) {
+        return -1;
+    }
+    cur.h->journal_size = 0;
     return 0;
 }
 
-int save_bookmarks(char *filename)
+/*
+ * rebuild - Make a new table from the snapshot and the journal (or the
+ *     text file, the first time). Called with the journal locked.
+ */
+static int rebuild(void)
 {
-    if (bookmarks == NULL) {
+    struct table t;
+    int snap;
+    if (create_table(&t, INIT_SLOTS, INIT_SLOTS / 2, INIT_STRINGS) < 0) {
+        app_error("out of space!!");
+        return -1;
+    }
+    install(&t, 0);
+    if ((snap = load_snapshot()) == 0) {
+        /* nothing saved the new way yet: import the text file */
+        if (journal_size() == 0 && load_text(text_file) > 0) {
+            write_snapshot();
+        }
+    }
+    if (journal_fd >= 0) {
+        replay_journal();
+    }
+    cur.h->journal_size = journal_size();
+    end_write(&cur);
+    return snap < 0 ? -1 : 0;
+}
+
+/*
+ * lock_table - Lock the journal and make sure the table mapped is the
+ *     current one, and whole. Returns -1 if it had to be rebuilt and the
+ *     snapshot was damaged.
+ */
+static int lock_table(void)
+{
+    if (journal_fd < 0) {
         return 0;
     }
-    FILE *fp;
-    int size = size_linked_ht(bookmarks);
-    char *keys[size];
-    char *values[size];
+    flock(journal_fd, LOCK_EX);
+    while (cur.h == NULL || cur.h->moved) {
+        if (map_table() < 0) {
+            return rebuild();
+        }
+    }
+    /* odd with the lock held: the last writer died in a change */
+    if ((cur.h->seq & 1) != 0) {
+        return rebuild();
+    }
+    return 0;
+}
+
+static void unlock_table(void)
+{
+    if (journal_fd >= 0) {
+        flock(journal_fd, LOCK_UN);
+    }
+}
+
+/*
+ * begin_read - Wait for the table to be still, and return its count in
+ *     seq; -1 if there's no table. A count that stays odd has the table
+ *     checked under the lock.
+ */
+static int begin_read(uint32_t *seq)
+{
+    for (int tries = 0; cur.h != NULL; tries++) {
+        if (tries % SPIN_TRIES == SPIN_TRIES - 1) {
+            if (tries > SPIN_TRIES || journal_fd < 0) {
+                return -1;
+            }
+            lock_table();
+            unlock_table();
+        }
+        *seq = __atomic_load_n(&cur.h->seq, __ATOMIC_ACQUIRE);
+        if ((*seq & 1) != 0) {
+            sched_yield();
+        } else if (cur.h->moved) {
+            map_table();
+        } else {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* end_read - Returns true if the table didn't change since begin_read */
+static int end_read(uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&cur.h->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/* append_record - Journal an add or remove record, and make the change */
+static int append_record(char op, const char *alias, const char *path)
+{
+    uint32_t alias_len = strlen(alias);
+    uint32_t path_len = strlen(path);
+    size_t n = RECORD_HEADER + alias_len + path_len;
+    char r[n];
+    uint32_t check;
+    int result = 0;
+
+    r[4] = op;
+    memcpy(r + 5, &alias_len, 4);
+    memcpy(r + 9, &path_len, 4);
+    memcpy(r + RECORD_HEADER, alias, alias_len);
+    memcpy(r + RECORD_HEADER + alias_len, path, path_len);
+    check = fnv32(r + 4, n - 4);
+    memcpy(r, &check, 4);
+
+    lock_table();
+    if (op == OP_REMOVE && find_slot(&cur, alias, fnv32(alias, alias_len)) < 0) {
+        unlock_table();
+        return -1;
+    }
+    /* one write on an O_APPEND fd: a crash can't split it from its header */
+    if (journal_fd >= 0 && write(journal_fd, r, n) != (ssize_t) n) {
+        result = -1;
+    }
+    begin_write(&cur);
+    if (op == OP_ADD) {
+        result = table_put(alias, path) < 0 ? -1 : result;
+    } else {
+        table_remove(alias);
+    }
+    end_write(&cur);
+    /* only now: a crash before this has the next session rebuild */
+    cur.h->journal_size = journal_size();
+    if (cur.h->journal_size > COMPACT_BYTES) {
+        write_snapshot();
+    }
+    unlock_table();
+    return result;
+}
+
+/*
+ * load_bookmarks - Map the bookmark table kept for filename (~/.tshinfo
+ *     by default), shared with the other sessions, rebuilding it from
+ *     the snapshot and the journal if it isn't up to date. Bookmarks
+ *     added or removed from then on are journaled as they change.
+ */
+int load_bookmarks(char *filename)
+{
     char filebuf[BUFSIZE];
-    get_all_linked_ht_data(bookmarks, keys, values, size);
+    int result;
     if (!filename) {
         filename = filebuf;
-        sprintf(filename, "%s/%s", get_home_dir(), default_file);
+        snprintf(filename, BUFSIZE, "%s/%s", get_home_dir(), default_file);
     }
-    if ((fp = fopen(filename, "w")) == NULL) {
-        app_error("can't open bookmark file!");
-        return -1;
+    snprintf(text_file, sizeof(text_file), "%s", filename);
+    snprintf(snap_file, sizeof(snap_file), "%s.snap", filename);
+    snprintf(journal_file, sizeof(journal_file), "%s.journal", filename);
+    snprintf(table_file, sizeof(table_file), "%s.table", filename);
+    if (journal_fd >= 0) {
+        close(journal_fd);
     }
-    for (int i = 0; i < size; i++) {
-        fprintf(fp, "%s\n", keys[i]);
-        fprintf(fp, "%s\n", values[i]);
+    cur.h = NULL;
+    journal_fd = open(journal_file, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (journal_fd < 0) {
+        return rebuild();
     }
-    fclose(fp);
-    return 0;
+    if ((result = lock_table()) == 0 && cur.h->journal_size != journal_size()) {
+        /* another tsh journaled without the table, or died in between */
+        result = rebuild();
+    }
+    unlock_table();
+    return result;
 }
 
-void list_bookmarks()
+/*
+ * save_bookmarks - Compact the bookmark files. The journal already has
+ *     every change, so this only makes the next rebuild faster.
+ */
+int save_bookmarks(void)
 {
-    if (bookmarks == NULL) {
-        return;
+    int result;
+    if (cur.h == NULL || journal_fd < 0) {
+        return -1;
     }
-    int size = size_linked_ht(bookmarks);
-    char *keys[size];
-    char *values[size];
-    get_all_linked_ht_data(bookmarks, keys, values, size);
+    lock_table();
+    result = write_snapshot();
+    unlock_table();
+    return result;
+}
+
+/*
+ * all_bookmarks - Fill keys and values (either can be NULL) from a,
+ *     newest first; returns how many.
+ */
+static int all_bookmarks(char ***keys, char ***values, arena a)
+{
+    uint32_t seq;
+    int n;
+    do {
+        if (begin_read(&seq) < 0) {
+            *keys = alloc_arena(a, sizeof(char *));
+            *values = NULL;
+            (*keys)[0] = NULL;
+            return 0;
+        }
+        uint32_t used = cur.h->used < cur.h->entries_cap ? cur.h->used : cur.h->entries_cap;
+        *keys = alloc_arena(a, (used + 1) * sizeof(char *));
+        *values = alloc_arena(a, (used + 1) * sizeof(char *));
+        n = 0;
+        for (uint32_t i = used; i > 0; i--) {
+            struct table_entry *e = &cur.entries[i - 1];
+            if (e->path != 0 && e->path < cur.h->strings_cap && e->alias < cur.h->strings_cap) {
+                (*keys)[n] = cur.strings + e->alias;
+                (*values)[n++] = cur.strings + e->path;
+            }
+        }
+        (*keys)[n] = NULL;
+    } while (!end_read(seq));
+    return n;
+}
+
+void list_bookmarks(int output_fd)
+{
+    arena a = create_arena(0);
+    char **keys, **values;
+    int size = all_bookmarks(&keys, &values, a);
+    fflush(stdout);
     for (int i = 0; i < size; i++) {
-        printf("%s => %s\n", keys[i], values[i]);
+        dprintf(output_fd, "%s => %s\n", keys[i], values[i]);
     }
+    dispose_arena(a);
 }
 
+/* bookmark_names - Returns the bookmark names, allocated from a */
+char **bookmark_names(int *count, arena a)
+{
+    char **keys, **values;
+    *count = all_bookmarks(&keys, &values, a);
+    return keys;
+}
+
+/* get_bookmark - The path of alias, read from the shared table without a lock */
 char *get_bookmark(char *alias)
 {
-    return bookmarks != NULL ? get_linked_ht(bookmarks, alias) : NULL;
+    uint32_t hash = fnv32(alias, strlen(alias));
+    uint32_t seq, path;
+    long s;
+    do {
+        if (begin_read(&seq) < 0) {
+            return NULL;
+        }
+        path = 0;
+        if ((s = find_slot(&cur, alias, hash)) >= 0 && cur.slots[s] - 1 < cur.h->entries_cap) {
+            path = cur.entries[cur.slots[s] - 1].path;
+        }
+    } while (!end_read(seq));
+    return path != 0 && path < cur.h->strings_cap ? cur.strings + path : NULL;
 }
 
 int remove_bookmark(char *alias)
 {
-    return bookmarks != NULL ? remove_linked_ht(bookmarks, alias) : -1;
+    if (cur.h == NULL && load_bookmarks(NULL) < 0) {
+        return -1;
+    }
+    return append_record(OP_REMOVE, alias, "");
 }
 
 int add_bookmark(char *alias, char *path)
 {
-    if (bookmarks == NULL) {
-        if ((bookmarks = create_linked_ht()) == NULL) {
-            return -1;
-        }
+    if (cur.h == NULL && load_bookmarks(NULL) < 0) {
+        return -1;
     }
-    return put_linked_ht(bookmarks, alias, path);
+    return append_record(OP_ADD, alias, path);
 }
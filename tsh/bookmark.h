@@ -1,9 +1,13 @@
 #ifndef OS_HW_BOOKMARK_H
 #define OS_HW_BOOKMARK_H
 
+#include "arena.h"
+
+const char *get_home_dir();
+
 int load_bookmarks(char *filename);
 
-int save_bookmarks(char *filename);
+int save_bookmarks(void);
 
 char *get_bookmark(char *alias);
 
@@ -11,6 +15,8 @@ int remove_bookmark(char *alias);
 
 int add_bookmark(char *alias, char *path);
 
-void list_bookmarks();
+void list_bookmarks(int output_fd);
+
+char **bookmark_names(int *count, arena a);
 
 #endif //OS_HW_BOOKMARK_H
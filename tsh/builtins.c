@@ -0,0 +1,593 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "builtins.h"
+#include "errmsg.h"
+
+/*
+ * Builtins that stand in for the external commands scripts run most:
+ * echo, printf, pwd, true, false and test/[. They are stage builtins, so
+ * a line of its own runs in the shell, with its redirections, and a
+ * pipeline stage in a fork of the shell, without an exec; either way no
+ * binary is loaded. Output is built in a buffer and written at once. To
+ * stdout it goes through the shell's own stdio buffer, which -q only
+ * flushes when a command is started, so a script of echoes makes few
+ * writes.
+ *
+ * They follow the coreutils commands of the same name, less the locale
+ * and the long options: 'tsh -B' launches those instead.
+ */
+struct out_buf
+{
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+static struct out_buf out;     /* reused by every call */
+
+/* reserve - Make room for n more bytes in o */
+static void reserve(struct out_buf *o, size_t n)
+{
+    if (o->len + n <= o->cap)
+        return;
+    while (o->len + n > o->cap)
+        o->cap = o->cap > 0 ? o->cap * 2 : 256;
+    if ((o->data = realloc(o->data, o->cap)) == NULL)
+        app_error("out of space!!");
+}
+
+static void put(struct out_buf *o, const char *s, size_t len)
+{
+    reserve(o, len);
+    memcpy(o->data + o->len, s, len);
+    o->len += len;
+}
+
+static void put_char(struct out_buf *o, char c)
+{
+    reserve(o, 1);
+    o->data[o->len++] = c;
+}
+
+/* put_format - Append what snprintf makes of spec */
+static void put_format(struct out_buf *o, const char *spec, ...)
+{
+    va_list ap;
+    int n;
+    va_start(ap, spec);
+    n = vsnprintf(NULL, 0, spec, ap);
+    va_end(ap);
+    if (n < 0)
+        return;
+    reserve(o, (size_t) n + 1);
+    va_start(ap, spec);
+    vsnprintf(o->data + o->len, (size_t) n + 1, spec, ap);
+    va_end(ap);
+    o->len += n;
+}
+
+/* flush_out - Write out o to output_fd and empty it; returns -1 on failure */
+static int flush_out(struct out_buf *o, int output_fd)
+{
+    size_t done = 0;
+    ssize_t n;
+    int result = 0;
+    if (output_fd == STDOUT_FILENO) {
+        if (fwrite(o->data, 1, o->len, stdout) < o->len)
+            result = -1;
+    } else {
+        while (done < o->len) {
+            if ((n = write(output_fd, o->data + done, o->len - done)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                result = -1;
+                break;
+            }
+            done += n;
+        }
+    }
+    o->len = 0;
+    return result;
+}
+
+/*
+ * put_escape - Append the character of the backslash escape at *p (just
+ *     past the backslash), and move *p past it. Octal is \0nnn if
+ *     zero_octal (echo -e, %b) and \nnn otherwise (a printf format).
+ *     Returns 1 for \c, which ends the output.
+ */
+static int put_escape(struct out_buf *o, const char **p, int zero_octal)
+{
+    const char *s = *p;
+    int c, digits;
+    switch (*s) {
+        case 'a': c = '\a'; break;
+        case 'b': c = '\b'; break;
+        case 'e': c = 27; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'v': c = '\v'; break;
+        case '\\': c = '\\'; break;
+        case 'c':
+            *p = s + 1;
+            return 1;
+        case 'x':
+            if (!isxdigit((unsigned char) s[1])) {
+                put_char(o, '\\');
+                c = 'x';
+                break;
+            }
+            for (c = 0, digits = 0, s++; digits < 2 && isxdigit((unsigned char) *s); digits++, s++)
+                c = c * 16 + (isdigit((unsigned char) *s) ? *s - '0' : (*s | 0x20) - 'a' + 10);
+            put_char(o, (char) c);
+            *p = s;
+            return 0;
+        case '\0':
+            put_char(o, '\\');
+            return 0;
+        default:
+            if (*s >= '0' && *s <= '7' && (!zero_octal || *s == '0')) {
+                if (zero_octal)
+                    s++;
+                for (c = 0, digits = 0; digits < 3 && *s >= '0' && *s <= '7'; digits++, s++)
+                    c = c * 8 + (*s - '0');
+                put_char(o, (char) c);
+                *p = s;
+                return 0;
+            }
+            put_char(o, '\\');
+            c = *s;
+    }
+    put_char(o, (char) c);
+    *p = s + 1;
+    return 0;
+}
+
+/* put_escaped - Append s with its escapes expanded; returns 1 if it had \c */
+static int put_escaped(struct out_buf *o, const char *s)
+{
+    for (; *s != '\0'; s++) {
+        if (*s != '\\') {
+            put_char(o, *s);
+            continue;
+        }
+        s++;
+        if (put_escape(o, &s, 1))
+            return 1;
+        s--;
+    }
+    return 0;
+}
+
+/*
+ * echo_builtin - echo [-neE] [args]: print the args, separated by spaces.
+ *     -n leaves out the newline, -e expands backslash escapes, -E doesn't.
+ */
+int echo_builtin(int argc, char **argv, int input_fd, int output_fd)
+{
+    int newline = 1, escapes = 0, stop = 0;
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0' &&
+                argv[i][strspn(argv[i] + 1, "neE") + 1] == '\0'; i++) {
+        for (const char *f = argv[i] + 1; *f != '\0'; f++) {
+            if (*f == 'n')
+                newline = 0;
+            else
+                escapes = *f == 'e';
+        }
+    }
+    for (int first = i; i < argc && !stop; i++) {
+        if (i > first)
+            put_char(&out, ' ');
+        if (escapes)
+            stop = put_escaped(&out, argv[i]);
+        else
+            put(&out, argv[i], strlen(argv[i]));
+    }
+    if (newline && !stop)
+        put_char(&out, '\n');
+    return flush_out(&out, output_fd) < 0;
+}
+
+/* printf_number - The value of a numeric printf argument ('c for a character) */
+static int printf_number(const char *arg, int is_unsigned, long long *value, double *real, int is_real)
+{
+    char *end;
+    errno = 0;
+    if (arg[0] == '\'' || arg[0] == '"') {
+        *value = (unsigned char) arg[1];
+        *real = (double) *value;
+        return 0;
+    }
+    if (is_real)
+        *real = strtod(arg, &end);
+    else if (is_unsigned)
+        *value = (long long) strtoull(arg, &end, 0);
+    else
+        *value = strtoll(arg, &end, 0);
+    if (end == arg || *end != '\0' || errno != 0) {
+        fflush(stdout);
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * printf_builtin - printf format [args]: print the args as format says.
+ *     The format is used again while args are left, and a missing arg is
+ *     taken as "" or 0. Supports the flags, width and precision (* too)
+ *     of printf(3), the d i o u x X c s f F e E g G a A conversions, %b
+ *     for an arg with backslash escapes, and escapes in the format.
+ */
+int printf_builtin(int argc, char **argv, int input_fd, int output_fd)
+{
+    char spec[64];
+    const char *f;
+    long long value;
+    double real;
+    int arg = 2, used, result = 0, stop = 0;
+
+    if (argc < 2) {
+        fflush(stdout);
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 1;
+    }
+    do {
+        used = arg;
+        for (f = argv[1]; *f != '\0' && !stop; f++) {
+            if (*f == '\\') {
+                f++;
+                stop = put_escape(&out, &f, 0);
+                f--;
+                continue;
+            }
+            if (*f != '%') {
+                put_char(&out, *f);
+                continue;
+            }
+            if (f[1] == '%') {
+                put_char(&out, '%');
+                f++;
+                continue;
+            }
+            /* %[flags][width][.precision]conversion, * taken from the args */
+            int n = 0;
+            spec[n++] = '%';
+            for (f++; *f != '\0' && strchr("-+ #0", *f) != NULL && n < 8; f++)
+                spec[n++] = *f;
+            if (*f == '*') {
+                n += snprintf(spec + n, 16, "%d", arg < argc ? atoi(argv[arg++]) : 0);
+                f++;
+            } else {
+                for (; isdigit((unsigned char) *f) && n < 24; f++)
+                    spec[n++] = *f;
+            }
+            if (*f == '.') {
+                spec[n++] = *f++;
+                if (*f == '*') {
+                    n += snprintf(spec + n, 16, "%d", arg < argc ? atoi(argv[arg++]) : 0);
+                    f++;
+                } else {
+                    for (; isdigit((unsigned char) *f) && n < 48; f++)
+                        spec[n++] = *f;
+                }
+            }
+            const char *a = arg < argc ? argv[arg++] : NULL;
+            switch (*f) {
+                case 'd':
+                case 'i':
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X':
+                    value = 0;
+                    if (a != NULL && printf_number(a, *f != 'd' && *f != 'i', &value, &real, 0) < 0)
+                        result = 1;
+                    spec[n++] = 'l';
+                    spec[n++] = 'l';
+                    spec[n++] = *f;
+                    spec[n] = '\0';
+                    put_format(&out, spec, value);
+                    break;
+                case 'f':
+                case 'F':
+                case 'e':
+                case 'E':
+                case 'g':
+                case 'G':
+                case 'a':
+                case 'A':
+                    real = 0;
+                    if (a != NULL && printf_number(a, 0, &value, &real, 1) < 0)
+                        result = 1;
+                    spec[n++] = *f;
+                    spec[n] = '\0';
+                    put_format(&out, spec, real);
+                    break;
+                case 'c': {
+                    char one[2] = {a != NULL ? a[0] : '\0', '\0'};
+                    spec[n++] = 's';    /* so a missing arg prints no NUL */
+                    spec[n] = '\0';
+                    put_format(&out, spec, one);
+                    break;
+                }
+                case 's':
+                    spec[n++] = 's';
+                    spec[n] = '\0';
+                    put_format(&out, spec, a != NULL ? a : "");
+                    break;
+                case 'b': {
+                    /* expand the escapes, then pad or cut like %s */
+                    size_t start = out.len;
+                    char *expanded;
+                    stop = a != NULL && put_escaped(&out, a);
+                    if ((expanded = strndup(out.data + start, out.len - start)) == NULL)
+                        app_error("out of space!!");
+                    out.len = start;
+                    spec[n++] = 's';
+                    spec[n] = '\0';
+                    put_format(&out, spec, expanded);
+                    free(expanded);
+                    break;
+                }
+                default:
+                    fflush(stdout);
+                    fprintf(stderr, "printf: %%%c: invalid conversion\n", *f != '\0' ? *f : ' ');
+                    flush_out(&out, output_fd);
+                    return 1;
+            }
+        }
+    } while (arg < argc && arg > used && !stop);
+    return flush_out(&out, output_fd) < 0 || result;
+}
+
+/* pwd_builtin - pwd: print the working directory */
+int pwd_builtin(int argc, char **argv, int input_fd, int output_fd)
+{
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL) {
+        fflush(stdout);
+        fprintf(stderr, "pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    put(&out, cwd, strlen(cwd));
+    put_char(&out, '\n');
+    free(cwd);
+    return flush_out(&out, output_fd) < 0;
+}
+
+int true_builtin(int argc, char **argv, int input_fd, int output_fd)
+{
+    return 0;
+}
+
+int false_builtin(int argc, char **argv, int input_fd, int output_fd)
+{
+    return 1;
+}
+
+/*
+ * test - An expression being evaluated:
+ *     or  := and [-o or]      and := not [-a and]     not := ! not | primary
+ *     primary := ( or ) | arg binop arg | unop arg | arg
+ */
+struct test
+{
+    char **args;
+    int n;
+    int pos;
+    const char *error;  /* set on a syntax error */
+};
+
+static int test_or(struct test *t);
+
+/* test_integer - Parse an integer operand, setting t->error if it isn't one */
+static long long test_integer(struct test *t, const char *s)
+{
+    char *end;
+    long long v;
+    errno = 0;
+    v = strtoll(s, &end, 10);
+    while (*end == ' ' || *end == '\t')
+        end++;
+    if (end == s || *end != '\0' || errno != 0)
+        t->error = "integer expression expected";
+    return v;
+}
+
+static int is_binop(const char *s)
+{
+    static const char *ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+                                "-nt", "-ot", "-ef", NULL};
+    for (int i = 0; ops[i] != NULL; i++) {
+        if (!strcmp(ops[i], s))
+            return 1;
+    }
+    return 0;
+}
+
+static int test_binary(struct test *t, const char *a, const char *op, const char *b)
+{
+    struct stat sa, sb;
+    long long x, y;
+    if (!strcmp(op, "=") || !strcmp(op, "=="))
+        return strcmp(a, b) == 0;
+    if (!strcmp(op, "!="))
+        return strcmp(a, b) != 0;
+    if (!strcmp(op, "<"))
+        return strcmp(a, b) < 0;
+    if (!strcmp(op, ">"))
+        return strcmp(a, b) > 0;
+    if (op[1] == 'n' || op[1] == 'o' || !strcmp(op, "-ef")) {
+        int ha = stat(a, &sa) == 0, hb = stat(b, &sb) == 0;
+        if (!strcmp(op, "-ef"))
+            return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        if (!strcmp(op, "-nt"))
+            return ha && (!hb || sa.st_mtim.tv_sec > sb.st_mtim.tv_sec ||
+                          (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec));
+        if (!strcmp(op, "-ot"))
+            return hb && (!ha || sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ||
+                          (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec));
+    }
+    x = test_integer(t, a);
+    y = test_integer(t, b);
+    if (!strcmp(op, "-eq"))
+        return x == y;
+    if (!strcmp(op, "-ne"))
+        return x != y;
+    if (!strcmp(op, "-lt"))
+        return x < y;
+    if (!strcmp(op, "-le"))
+        return x <= y;
+    if (!strcmp(op, "-gt"))
+        return x > y;
+    return x >= y;
+}
+
+/* test_unary - Evaluate unop (a known one, like -f) on s; -1 if op isn't one */
+static int test_unary(const char *op, const char *s)
+{
+    struct stat sb;
+    if (op[0] != '-' || op[1] == '\0' || op[2] != '\0')
+        return -1;
+    switch (op[1]) {
+        case 'n': return s[0] != '\0';
+        case 'z': return s[0] == '\0';
+        case 'r': return access(s, R_OK) == 0;
+        case 'w': return access(s, W_OK) == 0;
+        case 'x': return access(s, X_OK) == 0;
+        case 't': return isatty(atoi(s));
+        case 'h':
+        case 'L': return lstat(s, &sb) == 0 && S_ISLNK(sb.st_mode);
+        case 'e':
+        case 'f':
+        case 'd':
+        case 's':
+        case 'p':
+        case 'S':
+        case 'b':
+        case 'c':
+        case 'g':
+        case 'u':
+        case 'k':
+        case 'O':
+        case 'G':
+            break;
+        default:
+            return -1;
+    }
+    if (stat(s, &sb) < 0)
+        return 0;
+    switch (op[1]) {
+        case 'f': return S_ISREG(sb.st_mode);
+        case 'd': return S_ISDIR(sb.st_mode);
+        case 's': return sb.st_size > 0;
+        case 'p': return S_ISFIFO(sb.st_mode);
+        case 'S': return S_ISSOCK(sb.st_mode);
+        case 'b': return S_ISBLK(sb.st_mode);
+        case 'c': return S_ISCHR(sb.st_mode);
+        case 'g': return (sb.st_mode & S_ISGID) != 0;
+        case 'u': return (sb.st_mode & S_ISUID) != 0;
+        case 'k': return (sb.st_mode & S_ISVTX) != 0;
+        case 'O': return sb.st_uid == geteuid();
+        case 'G': return sb.st_gid == getegid();
+        default: return 1;  /* -e */
+    }
+}
+
+static int test_primary(struct test *t)
+{
+    char **a = t->args + t->pos;
+    int left = t->n - t->pos;
+    int r;
+    if (left <= 0) {
+        t->error = "argument expected";
+        return 0;
+    }
+    if (left >= 3 && is_binop(a[1])) {
+        t->pos += 3;
+        return test_binary(t, a[0], a[1], a[2]);
+    }
+    if (!strcmp(a[0], "(") && left >= 2) {
+        t->pos++;
+        r = test_or(t);
+        if (t->pos >= t->n || strcmp(t->args[t->pos], ")") != 0)
+            t->error = "')' expected";
+        t->pos++;
+        return r;
+    }
+    if (left >= 2 && (r = test_unary(a[0], a[1])) >= 0) {
+        t->pos += 2;
+        return r;
+    }
+    t->pos++;
+    return a[0][0] != '\0';
+}
+
+static int test_not(struct test *t)
+{
+    if (t->pos < t->n - 1 && !strcmp(t->args[t->pos], "!")) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static int test_and(struct test *t)
+{
+    int r = test_not(t);
+    while (t->pos < t->n - 1 && !strcmp(t->args[t->pos], "-a")) {
+        t->pos++;
+        r = test_not(t) && r;
+    }
+    return r;
+}
+
+static int test_or(struct test *t)
+{
+    int r = test_and(t);
+    while (t->pos < t->n - 1 && !strcmp(t->args[t->pos], "-o")) {
+        t->pos++;
+        r = test_and(t) || r;
+    }
+    return r;
+}
+
+/*
+ * test_builtin - test expr, or [ expr ]: exit with 0 if expr is true,
+ *     1 if it's false and 2 if it's malformed. No expr is false.
+ */
+int test_builtin(int argc, char **argv, int input_fd, int output_fd)
+{
+    struct test t = {argv + 1, argc - 1, 0, NULL};
+    int r;
+    if (!strcmp(argv[0], "[")) {
+        if (argc < 2 || strcmp(argv[argc - 1], "]") != 0) {
+            fflush(stdout);
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        t.n--;
+    }
+    if (t.n == 0)
+        return 1;
+    r = test_or(&t);
+    if (t.error == NULL && t.pos < t.n)
+        t.error = "too many arguments";
+    if (t.error != NULL) {
+        fflush(stdout);
+        fprintf(stderr, "%s: %s\n", argv[0], t.error);
+        return 2;
+    }
+    return !r;
+}
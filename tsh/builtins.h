@@ -0,0 +1,16 @@
+#ifndef OS_HW_BUILTINS_H
+#define OS_HW_BUILTINS_H
+
+int echo_builtin(int argc, char **argv, int input_fd, int output_fd);
+
+int printf_builtin(int argc, char **argv, int input_fd, int output_fd);
+
+int pwd_builtin(int argc, char **argv, int input_fd, int output_fd);
+
+int true_builtin(int argc, char **argv, int input_fd, int output_fd);
+
+int false_builtin(int argc, char **argv, int input_fd, int output_fd);
+
+int test_builtin(int argc, char **argv, int input_fd, int output_fd);
+
+#endif //OS_HW_BUILTINS_H
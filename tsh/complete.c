@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "complete.h"
+#include "bookmark.h"
+#include "exec.h"
+#include "errmsg.h"
+
+#define DIR_CACHE_MAX 64        /* directories whose listings are kept */
+#define INIT_ENTRIES  64        /* entries in a new listing */
+#define EVENT_BUF     4096      /* inotify events read at a time */
+
+/* changes that make a listing stale; IN_ATTRIB for chmod +x */
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+                    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+/* characters escaped in a completed word */
+#define SPECIAL_CHARS " \t'\"\\<>|&()"
+
+/* entry flags */
+#define F_DIR  1
+#define F_EXEC 2
+
+struct dir_entry
+{
+    const char *name;
+    int flags;
+};
+
+/*
+ * A directory listing, sorted by name so a prefix is a binary search.
+ * While it's watched it's good until inotify reports a change in the
+ * directory, so a cached directory is never read or stat'ed again; if
+ * the watch can't be added, its mtime is checked on each use instead.
+ */
+struct listing
+{
+    char *path;                 /* absolute, NULL for a free slot */
+    arena a;                    /* names and entries */
+    struct dir_entry *entries;
+    int count;
+    int has_exec;               /* F_EXEC was worked out */
+    int valid;
+    int wd;                     /* inotify watch, -1 if none */
+    struct timespec mtime;
+    long used;                  /* last use, the oldest is evicted */
+};
+
+static struct listing listings[DIR_CACHE_MAX];
+static int inotify_fd = -1;
+static long ticks;
+static const char **builtin_names;
+
+/* completions being collected */
+struct matches
+{
+    char **v;
+    int n;
+    int cap;
+    arena a;
+};
+
+/* init_completion - Set the builtin names completed as commands */
+void init_completion(const char **builtins)
+{
+    builtin_names = builtins;
+}
+
+/* drain_events - Mark the listings inotify reported a change in as stale */
+static void drain_events(void)
+{
+    char buf[EVENT_BUF] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    ssize_t n;
+    if (inotify_fd < 0)
+        return;
+    while ((n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *) p;
+            for (int i = 0; i < DIR_CACHE_MAX; i++) {
+                if (listings[i].path == NULL)
+                    continue;
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    listings[i].valid = 0;
+                } else if (listings[i].wd == ev->wd) {
+                    listings[i].valid = 0;
+                    if (ev->mask & IN_IGNORED)  /* the watch is gone */
+                        listings[i].wd = -1;
+                }
+            }
+        }
+    }
+}
+
+/* unwatch - Remove l's watch unless another listing shares it */
+static void unwatch(struct listing *l)
+{
+    if (l->wd < 0)
+        return;
+    for (int i = 0; i < DIR_CACHE_MAX; i++) {
+        if (&listings[i] != l && listings[i].path != NULL && listings[i].wd == l->wd) {
+            l->wd = -1;
+            return;
+        }
+    }
+    inotify_rm_watch(inotify_fd, l->wd);
+    l->wd = -1;
+}
+
+/* free_listing - Empty a slot */
+static void free_listing(struct listing *l)
+{
+    unwatch(l);
+    free(l->path);
+    if (l->a != NULL)
+        dispose_arena(l->a);
+    memset(l, 0, sizeof(*l));
+    l->wd = -1;
+}
+
+/* clear_completion_cache - Forget every listing */
+void clear_completion_cache(void)
+{
+    for (int i = 0; i < DIR_CACHE_MAX; i++) {
+        if (listings[i].path != NULL)
+            free_listing(&listings[i]);
+    }
+}
+
+static int by_name(const void *a, const void *b)
+{
+    return strcmp(((const struct dir_entry *) a)->name, ((const struct dir_entry *) b)->name);
+}
+
+/* read_dir - (Re)read l's directory. Returns -1 if it can't be read */
+static int read_dir(struct listing *l, int need_exec)
+{
+    struct dirent *d;
+    struct stat sb;
+    DIR *dir;
+    int cap = INIT_ENTRIES;
+    int flags;
+
+    /* watch first, so a change made while we read isn't missed */
+    if (inotify_fd < 0)
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (l->wd < 0 && inotify_fd >= 0)
+        l->wd = inotify_add_watch(inotify_fd, l->path, WATCH_MASK);
+    if ((dir = opendir(l->path)) == NULL)
+        return -1;
+    if (fstat(dirfd(dir), &sb) == 0)
+        l->mtime = sb.st_mtim;
+    if (l->a == NULL)
+        l->a = create_arena(0);
+    else
+        clear_arena(l->a);
+    l->entries = alloc_arena(l->a, cap * sizeof(struct dir_entry));
+    l->count = 0;
+    while ((d = readdir(dir)) != NULL) {
+        if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+            continue;
+        flags = d->d_type == DT_DIR ? F_DIR : 0;
+        /* a link, or a file system without d_type, or we need the mode */
+        if (d->d_type == DT_LNK || d->d_type == DT_UNKNOWN || (need_exec && d->d_type == DT_REG)) {
+            if (fstatat(dirfd(dir), d->d_name, &sb, 0) < 0)
+                continue;
+            flags = S_ISDIR(sb.st_mode) ? F_DIR : 0;
+            if (S_ISREG(sb.st_mode) && (sb.st_mode & 0111))
+                flags |= F_EXEC;
+        }
+        if (l->count == cap) {
+            struct dir_entry *grown = alloc_arena(l->a, 2 * cap * sizeof(struct dir_entry));
+            memcpy(grown, l->entries, l->count * sizeof(struct dir_entry));
+            l->entries = grown;
+            cap *= 2;
+        }
+        l->entries[l->count].name = strdup_arena(l->a, d->d_name);
+        l->entries[l->count++].flags = flags;
+    }
+    closedir(dir);
+    qsort(l->entries, l->count, sizeof(struct dir_entry), by_name);
+    l->has_exec = need_exec;
+    l->valid = 1;
+    return 0;
+}
+
+/* is_fresh - Returns true if l can be used as it is */
+static int is_fresh(const struct listing *l, int need_exec)
+{
+    struct stat sb;
+    if (!l->valid || (need_exec && !l->has_exec))
+        return 0;
+    if (l->wd >= 0)
+        return 1;
+    return stat(l->path, &sb) == 0 && sb.st_mtim.tv_sec == l->mtime.tv_sec &&
+           sb.st_mtim.tv_nsec == l->mtime.tv_nsec;
+}
+
+/*
+ * get_listing - Returns the listing of the absolute path, from the cache
+ *     when it's still good. need_exec asks for F_EXEC on each entry, which
+ *     takes a stat per file. Returns NULL if it can't be read.
+ */
+static struct listing *get_listing(const char *path, int need_exec)
+{
+    struct listing *l = NULL;
+    struct listing *oldest = &listings[0];
+
+    for (int i = 0; i < DIR_CACHE_MAX; i++) {
+        if (listings[i].path != NULL && !strcmp(listings[i].path, path)) {
+            l = &listings[i];
+            break;
+        }
+        if (listings[i].path == NULL || (oldest->path != NULL && listings[i].used < oldest->used))
+            oldest = &listings[i];
+    }
+    if (l == NULL) {
+        if (oldest->path != NULL)
+            free_listing(oldest);
+        l = oldest;
+        l->wd = -1;
+        if ((l->path = strdup(path)) == NULL)
+            app_error("out of space!!");
+    }
+    l->used = ++ticks;
+    if (!is_fresh(l, need_exec) && read_dir(l, need_exec || l->has_exec) < 0) {
+        free_listing(l);
+        return NULL;
+    }
+    return l;
+}
+
+/* first_with - Returns the first entry of l that starts with prefix */
+static int first_with(const struct listing *l, const char *prefix)
+{
+    size_t len = strlen(prefix);
+    int lo = 0, hi = l->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(l->entries[mid].name, prefix, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* add_match - Add word, escaped, with suffix */
+static void add_match(struct matches *m, const char *word, const char *suffix)
+{
+    char *s, *p;
+    if (m->n == m->cap) {
+        char **grown = alloc_arena(m->a, (m->cap = m->cap > 0 ? m->cap * 2 : 64) * sizeof(char *));
+        memcpy(grown, m->v, m->n * sizeof(char *));
+        m->v = grown;
+    }
+    p = s = alloc_arena(m->a, 2 * strlen(word) + strlen(suffix) + 1);
+    for (; *word != '\0'; word++) {
+        if (strchr(SPECIAL_CHARS, *word) != NULL)
+            *p++ = '\\';
+        *p++ = *word;
+    }
+    strcpy(p, suffix);
+    m->v[m->n++] = s;
+}
+
+/* complete_command - Builtins and the executables in PATH */
+static void complete_command(struct matches *m, const char *word)
+{
+    const char *path = getenv("PATH");
+    char dir[4096];
+    size_t len = strlen(word);
+    const char *name;
+    struct listing *l;
+
+    for (int i = 0; builtin_names != NULL && builtin_names[i] != NULL; i++) {
+        if (!strncmp(builtin_names[i], word, len) && strpbrk(builtin_names[i], SPECIAL_CHARS) == NULL)
+            add_match(m, builtin_names[i], " ");
+    }
+    for (int i = 0; (name = stage_builtin_name(i)) != NULL; i++) {
+        if (!strncmp(name, word, len))
+            add_match(m, name, " ");
+    }
+    for (const char *p = path != NULL ? path : "/bin:/usr/bin"; *p != '\0'; ) {
+        size_t n = strcspn(p, ":");
+        /* an empty or relative entry depends on the cwd: skip it */
+        if (n > 0 && p[0] == '/' && n < sizeof(dir)) {
+            memcpy(dir, p, n);
+            dir[n] = '\0';
+            if ((l = get_listing(dir, 1)) != NULL) {
+                for (int i = first_with(l, word); i < l->count && !strncmp(l->entries[i].name, word, len); i++) {
+                    if ((l->entries[i].flags & (F_EXEC | F_DIR)) == F_EXEC)
+                        add_match(m, l->entries[i].name, " ");
+                }
+            }
+        }
+        p += n;
+        if (*p == ':')
+            p++;
+    }
+}
+
+/* complete_path - The files (or only the directories) word is a prefix of */
+static void complete_path(struct matches *m, const char *word, int dirs_only)
+{
+    const char *slash = strrchr(word, '/');
+    const char *base = slash != NULL ? slash + 1 : word;
+    size_t dir_len = base - word;
+    size_t len = strlen(base);
+    char path[4096];
+    char *full;
+    struct listing *l;
+
+    /* the listing is cached by absolute path, the cwd may change */
+    if (word[0] == '/')
+        snprintf(path, sizeof(path), "%.*s", (int) dir_len, word);
+    else if (getcwd(path, sizeof(path)) != NULL)
+        snprintf(path + strlen(path), sizeof(path) - strlen(path), "/%.*s", (int) dir_len, word);
+    else
+        return;
+    if ((l = get_listing(path, 0)) == NULL)
+        return;
+    for (int i = first_with(l, base); i < l->count && !strncmp(l->entries[i].name, base, len); i++) {
+        const struct dir_entry *e = &l->entries[i];
+        if ((e->name[0] == '.' && base[0] != '.') || (dirs_only && !(e->flags & F_DIR)))
+            continue;
+        full = alloc_arena(m->a, dir_len + strlen(e->name) + 1);
+        sprintf(full, "%.*s%s", (int) dir_len, word, e->name);
+        add_match(m, full, e->flags & F_DIR ? "/" : " ");
+    }
+}
+
+/* complete_bookmark - The bookmarks word is a prefix of */
+static void complete_bookmark(struct matches *m, const char *word)
+{
+    int count;
+    char **names = bookmark_names(&count, m->a);
+    for (int i = 0; i < count; i++) {
+        if (!strncmp(names[i], word, strlen(word)))
+            add_match(m, names[i], " ");
+    }
+}
+
+static int by_string(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* is_sep - Returns true if line[i] ends a word (and isn't escaped) */
+static int is_sep(const char *line, size_t i)
+{
+    return strchr(" \t<>|&()", line[i]) != NULL && (i == 0 || line[i - 1] != '\\');
+}
+
+/*
+ * complete_line - Complete the word that ends at point. Sets word_start
+ *     to where it begins, and p_matches to the sorted words that can
+ *     replace it, escaped and followed by ' ' (or '/' for a directory);
+ *     returns how many there are.
+ *
+ * The first word of a command is completed as a builtin or a command in
+ * PATH, the word after cdb and rmb as a bookmark, the word after cd as a
+ * directory, and anything else as a path.
+ */
+int complete_line(const char *line, size_t point, size_t *word_start, char ***p_matches, arena a)
+{
+    struct matches m = {NULL, 0, 0, a};
+    size_t start = point, cmd, i;
+    char *word, *p;
+    int first;
+
+    drain_events();
+    while (start > 0 && !is_sep(line, start - 1))
+        start--;
+    /* the word without its quotes and escapes */
+    p = word = alloc_arena(a, point - start + 1);
+    for (i = start; i < point; i++) {
+        if (line[i] == '\\' && i + 1 < point)
+            i++;
+        else if (line[i] == '\'' || line[i] == '"')
+            continue;
+        *p++ = line[i];
+    }
+    *p = '\0';
+
+    /* where the command the word is in begins */
+    for (cmd = start; cmd > 0 && strchr("|&(", line[cmd - 1]) == NULL; cmd--)
+        ;
+    while (cmd < start && (line[cmd] == ' ' || line[cmd] == '\t'))
+        cmd++;
+    i = start;
+    while (i > cmd && (line[i - 1] == ' ' || line[i - 1] == '\t'))
+        i--;
+    first = cmd == start;
+
+    if (first && strchr(word, '/') == NULL) {
+        complete_command(&m, word);
+    } else if (!first && i > 0 && strchr("<>", line[i - 1]) != NULL) {
+        complete_path(&m, word, 0);
+    } else if (i == cmd + 3 && (!strncmp(line + cmd, "cdb", 3) || !strncmp(line + cmd, "rmb", 3))) {
+        complete_bookmark(&m, word);
+    } else {
+        complete_path(&m, word, !first && !strncmp(line + cmd, "cd ", 3));
+    }
+
+    /* sorted, without the duplicates PATH can give */
+    qsort(m.v, m.n, sizeof(char *), by_string);
+    int n = 0;
+    for (int j = 0; j < m.n; j++) {
+        if (n == 0 || strcmp(m.v[n - 1], m.v[j]) != 0)
+            m.v[n++] = m.v[j];
+    }
+    *word_start = start;
+    *p_matches = m.v;
+    return n;
+}
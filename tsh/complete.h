@@ -0,0 +1,14 @@
+#ifndef OS_HW_COMPLETE_H
+#define OS_HW_COMPLETE_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+void init_completion(const char **builtins);
+
+int complete_line(const char *line, size_t point, size_t *word_start, char ***p_matches, arena a);
+
+void clear_completion_cache(void);
+
+#endif //OS_HW_COMPLETE_H
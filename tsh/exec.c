@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "exec.h"
+#include "parse.h"
+#include "job.h"
+#include "stack.h"
+#include "util.h"
+#include "bookmark.h"
+#include "spawn.h"
+#include "pathcache.h"
+#include "pipesize.h"
+#include "xargs.h"
+#include "trace.h"
+#include "history.h"
+#include "histsearch.h"
+#include "reactor.h"
+#include "builtins.h"
+#include "errmsg.h"
+
+/* holds the words and argv of the line being run, cleared after each line */
+arena cmd_arena;
+
+int fast_builtins = 1;
+
+/* room for "/dev/fd/<fd>" */
+#define SUBS_PATH_LEN 24
+
+int jobs_builtin(int argc, char **argv, int input_fd, int output_fd)
+{
+    int verbose = argc > 1 && !strcmp(argv[1], "-l");
+    if (argc > 1 && !verbose) {
+        fflush(stdout);
+        fprintf(stderr, "jobs: usage: jobs [-l]\n");
+        return 1;
+    }
+    return listjobs(jobs, output_fd, verbose) < 0;
+}
+
+int lsb_builtin(int argc, char **argv, int input_fd, int output_fd)
+{
+    list_bookmarks(output_fd);
+    return 0;
+}
+
+/*
+ * history_builtin - history [N]: list every entry, or the last N.
+ *     history -p|-s words: list the entries starting with or containing them.
+ */
+int history_builtin(int argc, char **argv, int input_fd, int output_fd)
+{
+    long count = history_count();
+    long n = count;
+    char *end;
+    if (argc > 2 && (!strcmp(argv[1], "-p") || !strcmp(argv[1], "-s"))) {
+        char *pattern = join_args(argc - 2, argv + 2, cmd_arena);
+        int how = argv[1][1] == 'p' ? MATCH_PREFIX : MATCH_SUBSTRING;
+        long *found = NULL;
+        long cap = 0;
+        int result;
+        /* newest first, listed oldest first */
+        n = 0;
+        for (long i = count; (i = search_history(pattern, how, i)) >= 0; n++) {
+            if (n == cap && (found = realloc(found, (cap = cap > 0 ? cap * 2 : 64) * sizeof(long))) == NULL)
+                app_error("out of space!!");
+            found[n] = i;
+        }
+        for (long i = 0; i < n / 2; i++) {
+            long t = found[i];
+            found[i] = found[n - 1 - i];
+            found[n - 1 - i] = t;
+        }
+        result = list_history_entries(output_fd, found, n) < 0 || n == 0;
+        free(found);
+        return result;
+    }
+    if (argc > 1) {
+        n = strtol(argv[1], &end, 10);
+        if (*end != '\0' || n < 0) {
+            fflush(stdout);
+            fprintf(stderr, "history: usage: history [N] | [-p|-s words]\n");
+            return 1;
+        }
+    }
+    if (n > count)
+        n = count;
+    return list_history(output_fd, count - n, n) < 0;
+}
+
+int hash_builtin(int argc, char **argv, int input_fd, int output_fd)
+{
+    int result = 0;
+    if (argc < 2) {
+        list_path_cache(output_fd);
+    } else if (!strcmp(argv[1], "-r")) {
+        clear_path_cache();
+    } else {
+        for (int i = 1; i < argc; i++) {
+            if (lookup_path(argv[i]) == NULL) {
+                fprintf(stderr, "hash: %s: not found\n", argv[i]);
+                result = 1;
+            }
+        }
+    }
+    return result;
+}
+
+int pipestatus_builtin(int argc, char **argv, int input_fd, int output_fd)
+{
+    return print_pipestatus(output_fd) < 0;
+}
+
+static const struct stage_builtin stage_builtins[] = {
+    {"jobs",       jobs_builtin,       0},
+    {"lsb",        lsb_builtin,        0},
+    {"hash",       hash_builtin,       0},
+    {"xargs",      xargs_builtin,      0},
+    {"history",    history_builtin,    0},
+    {"pipestatus", pipestatus_builtin, 0},
+    {"echo",       echo_builtin,       1},
+    {"printf",     printf_builtin,     1},
+    {"pwd",        pwd_builtin,        1},
+    {"true",       true_builtin,       1},
+    {"false",      false_builtin,      1},
+    {"test",       test_builtin,       1},
+    {"[",          test_builtin,       1},
+    {NULL, NULL, 0}
+};
+
+/* find_entry - Returns the stage builtin table entry for name, or NULL */
+static const struct stage_builtin *find_entry(const char *name)
+{
+    for (int i = 0; name != NULL && stage_builtins[i].name != NULL; i++) {
+        if (!strcmp(stage_builtins[i].name, name)) {
+            return stage_builtins[i].fast && !fast_builtins ? NULL : &stage_builtins[i];
+        }
+    }
+    return NULL;
+}
+
+/* find_stage_builtin - Returns the stage builtin called name, or NULL */
+stage_builtin_t *find_stage_builtin(const char *name)
+{
+    const struct stage_builtin *b = find_entry(name);
+    return b != NULL ? b->func : NULL;
+}
+
+/*
+ * is_fast_builtin - Returns true if name is a builtin standing in for an
+ *     external command: it changes nothing in the shell, so it can run
+ *     anywhere a command could.
+ */
+int is_fast_builtin(const char *name)
+{
+    const struct stage_builtin *b = find_entry(name);
+    return b != NULL && b->fast;
+}
+
+/* stage_builtin_name - Returns the name of stage builtin i, NULL past the last */
+const char *stage_builtin_name(int i)
+{
+    return stage_builtins[i].name;
+}
+
+/*
+ * stage_exec - Run a stage builtin in this process with its redirections.
+ *     -1 for input_fd/output_fd means stdin/stdout. Returns its exit status.
+ */
+int stage_exec(char **argv, int input_fd, int output_fd)
+{
+    stage_builtin_t *func = find_stage_builtin(argv[0]);
+    int in = input_fd;
+    int out = output_fd;
+    int argc = 0;
+    int result = 1;
+    if (parse_redirect(argv, &in, &out) == 0) {
+        while (argv[argc] != NULL) {
+            argc++;
+        }
+        result = func(argc, argv, in != -1 ? in : STDIN_FILENO,
+                      out != -1 ? out : STDOUT_FILENO);
+    }
+    if (in != input_fd) {
+        close(in);
+    }
+    if (out != output_fd) {
+        close(out);
+    }
+    return result;
+}
+
+void single_exec(char **argv, int input_fd, int output_fd)
+{
+    if (find_stage_builtin(argv[0]) != NULL) {
+        int result = stage_exec(argv, input_fd, output_fd);
+        fflush(stdout);
+        trace_flush();
+        _exit(result);
+    }
+    if (parse_redirect(argv, &input_fd, &output_fd) < 0) {
+        _exit(1);
+    }
+    if (output_fd != -1) {
+        dup2(output_fd, STDOUT_FILENO);
+        close(output_fd);
+    }
+    if (input_fd != -1) {
+        dup2(input_fd, STDIN_FILENO);
+        close(input_fd);
+    }
+    const char *path = lookup_path(argv[0]);
+    int fd;
+    /* substitution pipes are close-on-exec, except where they are used */
+    for (int i = 0; argv[i] != NULL; i++) {
+        if ((fd = dev_fd_arg(argv[i])) > STDERR_FILENO)
+            fcntl(fd, F_SETFD, 0);
+    }
+    if (tracing() && path != NULL) {
+        /* the buffer goes away with the exec, write it out first */
+        trace_begin("exec");
+        trace_int("pid", getpid());
+        trace_str("path", path);
+        trace_argv("argv", argv);
+        trace_end();
+        trace_flush();
+    }
+    if (path == NULL || execv(path, argv) < 0) {
+        fprintf(stderr, "%s: Command not found.\n", argv[0]);
+        _exit(1);
+    }
+}
+
+/*
+ * spawn_exec - The posix_spawn counterpart of single_exec. It runs in the
+ *     parent, so the redirected files are opened here and closed again once
+ *     the child holds them. Returns the child pid, or -1 on failure.
+ */
+pid_t spawn_exec(char **argv, int input_fd, int output_fd, pid_t pgid,
+                 const int *close_fds, int nclose)
+{
+    int in = input_fd;
+    int out = output_fd;
+    pid_t pid = -1;
+    if (parse_redirect(argv, &in, &out) == 0) {
+        pid = spawn_cmd(argv, in, out, pgid, close_fds, nclose);
+    }
+    if (tracing() && pid > 0) {
+        /* posix_spawn returns once the child has exec'd */
+        trace_begin("exec");
+        trace_int("pid", pid);
+        trace_argv("argv", argv);
+        trace_str("launcher", "spawn");
+        trace_end();
+    }
+    if (in != input_fd) {
+        close(in);
+    }
+    if (out != output_fd) {
+        close(out);
+    }
+    return pid;
+}
+
+/*
+ * launch_pipeline - Start the cmd_count stages of a pipeline (or a single
+ *     command) as children of this process, each with fork or posix_spawn
+ *     as set by launcher, and a stage builtin in a fork without an exec.
+ *
+ *     The pipes are close-on-exec and made one at a time, as the stages
+ *     on both ends are started, so this process holds at most three pipe
+ *     fds at a fork and a child closes at most one, whatever the length of
+ *     the pipeline. Stages go into process group pgid: 0 for a new group
+ *     led by the first, -1 for this process's own.
+ *
+ *     pids[i] gets the pid of stage i, 0 if it couldn't be started, and
+ *     watch_fds[k] a close-on-exec copy of the read end of the pipe after
+ *     stage k if pipesz watches it, -1 if not. Returns the pid of the
+ *     first stage started, 0 if none.
+ */
+pid_t launch_pipeline(char **argv, const int *pos, int cmd_count, pid_t pgid,
+                      pid_t *pids, int *watch_fds)
+{
+    int watch = pipe_size_conf.mode == PIPESZ_AUTO || pipe_size_conf.verbose;
+    int fds[2];
+    int in = -1, out;
+    pid_t first = 0;
+    int i;
+
+    for (i = 0; i < cmd_count; i++) {
+        fds[0] = out = -1;
+        if (i != cmd_count - 1) {
+            if (make_pipe(fds, O_CLOEXEC) < 0) {
+                fprintf(stderr, "couldn't pipe\n");
+                break;
+            }
+            out = fds[1];
+        }
+        if (launch_mode == LAUNCH_SPAWN && find_stage_builtin(argv[pos[i]]) == NULL) {
+            if ((pids[i] = spawn_exec(argv + pos[i], in, out, pgid, NULL, 0)) < 0)
+                pids[i] = 0;
+        } else if ((pids[i] = trace_fork()) == 0) {
+            reactor_child();
+            if (pgid >= 0 && setpgid(0, pgid) < 0)
+                unix_error("launch_pipeline: setpgid failed");
+            if (fds[0] >= 0)    /* a builtin stage doesn't exec */
+                close(fds[0]);
+            if (in != -1) {
+                dup2(in, STDIN_FILENO);
+                close(in);
+            }
+            if (out != -1) {
+                dup2(out, STDOUT_FILENO);
+                close(out);
+            }
+            single_exec(argv + pos[i], -1, -1);
+        } else if (pids[i] < 0) {
+            fprintf(stderr, "%s: fork failed\n", argv[pos[i]]);
+            pids[i] = 0;
+        }
+        if (pids[i] > 0 && first == 0) {
+            first = pids[i];
+            if (pgid == 0)
+                pgid = first;
+        }
+        if (pids[i] > 0 && pgid > 0)
+            setpgid(pids[i], pgid);     /* the child does too, whichever is first */
+        if (tracing()) {
+            trace_begin("stage");
+            trace_int("stage", i);
+            trace_int("pid", pids[i]);
+            trace_argv("argv", argv + pos[i]);
+            trace_end();
+        }
+        if (i != 0) {
+            watch_fds[i - 1] = watch && pids[i] > 0 ? fcntl(in, F_DUPFD_CLOEXEC, 0) : -1;
+            close(in);
+        }
+        if (out != -1)
+            close(out);
+        in = fds[0];
+    }
+    for (; i < cmd_count; i++) {    /* after a failed pipe */
+        pids[i] = 0;
+        if (i != 0)
+            watch_fds[i - 1] = -1;
+    }
+    return first;
+}
+
+/*
+ * pipe_exec - Run a pipeline from a process of its own (the main command
+ *     of a line with substitutions, or a parallel script line) and exit
+ *     with the OR of the stage statuses. The shell's own pipelines are
+ *     launched by eval, straight into the job.
+ */
+void pipe_exec(char **argv, int *pos, int cmd_count)
+{
+    pid_t pids[cmd_count];      /* child running stage i, 0 if none */
+    int watch_fds[cmd_count];   /* read end of pipe i kept for wait_pipeline */
+    int result = 0;
+    /* stages are reaped by wait_pipeline */
+    signal(SIGCHLD, SIG_DFL);
+    launch_pipeline(argv, pos, cmd_count, -1, pids, watch_fds);
+    for (int i = 0; i < cmd_count; i++) {
+        if (pids[i] == 0)
+            result |= 1;
+    }
+    result |= wait_pipeline(pids, cmd_count, watch_fds);
+    if (tracing()) {
+        trace_begin("pipeline");
+        trace_int("stages", cmd_count);
+        trace_int("status", result);
+        trace_end();
+        trace_flush();
+    }
+    _exit(result);
+}
+
+void line_exec(int argc, char **argv, int input_fd, int output_fd)
+{
+    int *cmd_postions = alloc_arena(cmd_arena, (argc + 1) * sizeof(int));
+    int cmd_count = parse_pipe(argc, argv, cmd_postions);
+    if (cmd_count > 1) {
+        /* the first stage reads input_fd, the last writes output_fd */
+        if (input_fd != -1) {
+            dup2(input_fd, STDIN_FILENO);
+            close(input_fd);
+        }
+        if (output_fd != -1) {
+            dup2(output_fd, STDOUT_FILENO);
+            close(output_fd);
+        }
+        pipe_exec(argv, cmd_postions, cmd_count);
+    } else {
+        single_exec(argv, input_fd, output_fd);
+    }
+}
+
+/*
+ * resolve_cmds - Look every command word of the line up in the PATH cache
+ *     before forking, so the children find their paths already resolved
+ *     and the shell keeps them for the next line.
+ */
+void resolve_cmds(int argc, char **argv)
+{
+    for (int i = 0; i < argc; i++) {
+        if (i == 0 || is_op(argv[i - 1], TOK_PIPE) || is_op(argv[i - 1], TOK_SUBS_IN) ||
+            is_op(argv[i - 1], TOK_SUBS_OUT)) {
+            if (!is_op(argv[i], TOK_IN) && !is_op(argv[i], TOK_OUT) &&
+                find_stage_builtin(argv[i]) == NULL) {
+                lookup_path(argv[i]);
+            }
+        }
+    }
+}
+
+/*
+ * close_used_fds - Close this process's copy of every substitution pipe
+ *     that argv refers to, now that the process using it has been forked.
+ */
+static void close_used_fds(char **argv, int *sub_fds, int nsub)
+{
+    int fd;
+    for (int i = 0; argv[i] != NULL; i++) {
+        if ((fd = dev_fd_arg(argv[i])) < 0)
+            continue;
+        for (int k = 0; k < nsub; k++) {
+            if (sub_fds[k] == fd) {
+                close(fd);
+                sub_fds[k] = -1;
+            }
+        }
+    }
+}
+
+/*
+ * close_unused_fds - In a child, close the substitution pipes argv doesn't
+ *     refer to. They are close-on-exec, but a child that doesn't exec (a
+ *     pipeline process) would keep them open.
+ */
+static void close_unused_fds(char **argv, int *sub_fds, int nsub)
+{
+    int used;
+    for (int k = 0; k < nsub; k++) {
+        used = 0;
+        for (int i = 0; sub_fds[k] >= 0 && argv[i] != NULL && !used; i++)
+            used = dev_fd_arg(argv[i]) == sub_fds[k];
+        if (sub_fds[k] >= 0 && !used)
+            close(sub_fds[k]);
+    }
+}
+
+/*
+ * subs_exec - Run a command line with process substitutions, and exit
+ *     with the status of its main command.
+ *
+ * Each <(cmd) or >(cmd) is replaced by /dev/fd/N, the far end of a pipe
+ * to a producer (or consumer) running cmd. The producers are started as
+ * their ')' is read, innermost first, so they all run concurrently and are
+ * ready before the main command starts. The pipes are close-on-exec, and
+ * each process clears the flag only on the fds its own argv refers to, so
+ * no writer end leaks into an unrelated process and hides an EOF.
+ *
+ * Without substitutions the line is run right here. Otherwise the main
+ * command is forked too, and this process waits for every child it
+ * started before exiting.
+ */
+int subs_exec(int argc, char **argv)
+{
+    char **subargv = alloc_arena(cmd_arena, (argc + 1) * sizeof(char *));
+    int *sub_fds = alloc_arena(cmd_arena, argc * sizeof(int));   /* our end of each pipe */
+    int nsub = 0;
+    char *arg;
+    char *path;
+    int i, j;
+    int fds[2];
+    int flag = 0;
+    pid_t pid, main_pid;
+    int status;
+    int result = 1;
+    stack s;
+
+    for (i = 0; i < argc && !is_op(argv[i], TOK_RIGHT); i++)
+        ;
+    if (i == argc) {    /* no substitutions */
+        line_exec(argc, argv, -1, -1);
+    }
+
+    /* we reap our children ourselves */
+    signal(SIGCHLD, SIG_DFL);
+    s = create_stack(argc);
+    for (i = 0; i < argc; i++) {
+        if (!is_op(argv[i], TOK_RIGHT)) {
+            push(s, argv[i]);
+            continue;
+        }
+        j = 0;
+        while (!is_empty(s)) {
+            arg = top_and_pop(s);
+            if (is_op(arg, TOK_SUBS_IN) || is_op(arg, TOK_SUBS_OUT)) {
+                flag = is_op(arg, TOK_SUBS_OUT);
+                break;
+            }
+            subargv[j++] = arg;
+        }
+        subargv[j] = NULL;
+        reverse_array(subargv, j);
+        if (make_pipe(fds, O_CLOEXEC) < 0)
+            unix_error("subs_exec: pipe failed");
+        /* fds[flag] is ours, the producer gets fds[1 - flag] */
+        fflush(stdout);
+        if ((pid = trace_fork()) == 0) {
+            close(fds[flag]);
+            close_unused_fds(subargv, sub_fds, nsub);
+            line_exec(j, subargv, !flag ? -1 : fds[1 - flag], flag ? -1 : fds[1 - flag]);
+        }
+        if (pid < 0)
+            unix_error("subs_exec: fork failed");
+        if (tracing()) {
+            trace_begin("subs");
+            trace_int("pid", pid);
+            trace_str("dir", flag ? ">(" : "<(");
+            trace_int("fd", fds[flag]);
+            trace_argv("argv", subargv);
+            trace_end();
+        }
+        close(fds[1 - flag]);
+        close_used_fds(subargv, sub_fds, nsub);
+        sub_fds[nsub++] = fds[flag];
+        path = alloc_arena(cmd_arena, SUBS_PATH_LEN);
+        sprintf(path, "/dev/fd/%d", fds[flag]);
+        push(s, path);
+    }
+    j = 0;
+    while (!is_empty(s)) {
+        subargv[j++] = top_and_pop(s);
+    }
+    subargv[j] = NULL;
+    reverse_array(subargv, j);
+    dispose_stack(s);
+
+    fflush(stdout);
+    if ((main_pid = trace_fork()) == 0) {
+        close_unused_fds(subargv, sub_fds, nsub);
+        line_exec(j, subargv, -1, -1);
+    }
+    if (main_pid < 0)
+        unix_error("subs_exec: fork failed");
+    for (i = 0; i < nsub; i++) {
+        if (sub_fds[i] >= 0)
+            close(sub_fds[i]);
+    }
+    while ((pid = wait(&status)) > 0 || errno == EINTR) {
+        if (pid == main_pid)
+            result = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    }
+    trace_flush();
+    _exit(result);
+}
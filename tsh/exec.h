@@ -0,0 +1,50 @@
+#ifndef OS_HW_EXEC_H
+#define OS_HW_EXEC_H
+
+#include <sys/types.h>
+
+#include "arena.h"
+
+extern arena cmd_arena;
+
+/*
+ * Builtins that can be a pipeline stage. They read input_fd and write
+ * output_fd instead of stdin/stdout, and return an exit status.
+ */
+typedef int stage_builtin_t(int argc, char **argv, int input_fd, int output_fd);
+
+struct stage_builtin
+{
+    const char *name;
+    stage_builtin_t *func;
+    int fast;               /* stands in for an external command */
+};
+
+/* run echo, printf, pwd, true, false and test as builtins (tsh -B: don't) */
+extern int fast_builtins;
+
+stage_builtin_t *find_stage_builtin(const char *name);
+
+int is_fast_builtin(const char *name);
+
+const char *stage_builtin_name(int i);
+
+int stage_exec(char **argv, int input_fd, int output_fd);
+
+void single_exec(char **argv, int input_fd, int output_fd);
+
+pid_t spawn_exec(char **argv, int input_fd, int output_fd, pid_t pgid,
+                 const int *close_fds, int nclose);
+
+pid_t launch_pipeline(char **argv, const int *pos, int cmd_count, pid_t pgid,
+                      pid_t *pids, int *watch_fds);
+
+void pipe_exec(char **argv, int *pos, int cmd_count);
+
+void line_exec(int argc, char **argv, int input_fd, int output_fd);
+
+void resolve_cmds(int argc, char **argv);
+
+int subs_exec(int argc, char **argv);
+
+#endif //OS_HW_EXEC_H
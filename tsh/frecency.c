@@ -0,0 +1,507 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "frecency.h"
+#include "bookmark.h"
+#include "errmsg.h"
+
+#define DIRS_FILE      ".tsh_dirs"
+#define INIT_DIRS      256
+#define MAX_RANK       10000.0  /* total count past which old counts age */
+#define BOOKMARK_BOOST 4.0      /* a bookmark outranks a directory as often used */
+#define JUMP_TRIES     4        /* candidates tried before giving up on missing dirs */
+#define MAX_WORDS      8        /* query words; the rest are ignored */
+
+/*
+ * Directories cd'ed to, ranked by frecency: how often, weighted by how
+ * recently. cdb matches a query against them and the bookmark aliases.
+ *
+ * A query is matched against path components, not whole paths: there
+ * are far fewer distinct components than directories, since most share
+ * /home/user, src, build and the like. Each component is kept once, in
+ * lower case, with a 64-bit mask of its characters and a posting list of
+ * the directories it's in, so a lookup scans the component masks, runs
+ * the substring or subsequence match on the few that have every query
+ * character, and scores only the directories on their posting lists.
+ * Both the directories and the components are added as they're visited.
+ *
+ * Visits are appended to ~/.tsh_dirs (or TSH_DIRS) as "count\tlast\tpath"
+ * lines; on load they're summed per path, and the file is rewritten with
+ * one line per path when it has grown too many.
+ */
+struct dir_record
+{
+    char *path;
+    double count;           /* 0 once found missing */
+    time_t last;
+};
+
+struct component
+{
+    char *name;             /* lower case */
+    uint32_t *dirs;         /* dir index << 1, | 1 where it's the last component */
+    uint32_t ndirs;
+    uint32_t cap;
+};
+
+/* table - An open-addressing index of strings, entries -1 when empty */
+struct table
+{
+    int32_t *slots;
+    uint32_t size;          /* a power of two */
+};
+
+static struct dir_record *dirs;
+static int ndirs;
+static int dirs_cap;
+static struct table dir_index;
+
+static struct component *comps;
+static uint64_t *comp_masks;    /* apart, so the scan reads only them */
+static int ncomps;
+static int comps_cap;
+static struct table comp_index;
+
+static uint8_t *quality;        /* per directory, during a lookup */
+static uint32_t *touched;       /* the directories with a quality */
+
+static char *dirs_file;
+static int dirs_fd = -1;
+
+/* char_bit - The mask bit of c: letters (any case) and digits get their own */
+static inline uint64_t char_bit(unsigned char c)
+{
+    if (c >= 'a' && c <= 'z')
+        return 1ULL << (c - 'a');
+    if (c >= 'A' && c <= 'Z')
+        return 1ULL << (c - 'A');
+    if (c >= '0' && c <= '9')
+        return 1ULL << (26 + c - '0');
+    return 1ULL << (36 + c % 28);
+}
+
+static uint64_t mask_of(const char *s)
+{
+    uint64_t m = 0;
+    for (; *s != '\0'; s++)
+        m |= char_bit((unsigned char) *s);
+    return m;
+}
+
+static uint32_t hash_str(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s != '\0')
+        h = (h ^ (unsigned char) *s++) * 16777619u;
+    return h;
+}
+
+static const char *dir_key(int i)
+{
+    return dirs[i].path;
+}
+
+static const char *comp_key(int i)
+{
+    return comps[i].name;
+}
+
+/* lookup - The slot of s in t, or the empty one it would go in */
+static int32_t *lookup(struct table *t, const char *s, const char *(*key)(int))
+{
+    uint32_t i = hash_str(s) & (t->size - 1);
+    while (t->slots[i] >= 0 && strcmp(key(t->slots[i]), s) != 0)
+        i = (i + 1) & (t->size - 1);
+    return &t->slots[i];
+}
+
+/* reserve - Make room in t for one more of n entries, keeping it at most half full */
+static void reserve(struct table *t, int n, const char *(*key)(int))
+{
+    if (2 * (n + 1) <= (int) t->size)
+        return;
+    t->size = t->size > 0 ? t->size * 2 : 2 * INIT_DIRS;
+    free(t->slots);
+    if ((t->slots = malloc(t->size * sizeof(int32_t))) == NULL)
+        app_error("out of space!!");
+    memset(t->slots, -1, t->size * sizeof(int32_t));
+    for (int i = 0; i < n; i++)
+        *lookup(t, key(i), key) = i;
+}
+
+/* find_dir - The index of path, or -1 */
+static int find_dir(const char *path)
+{
+    return dir_index.size > 0 ? *lookup(&dir_index, path, dir_key) : -1;
+}
+
+/* add_component - Put directory d on the posting list of name (len bytes) */
+static void add_component(const char *name, size_t len, uint32_t d, int last)
+{
+    char lower[len + 1];
+    struct component *c;
+    int32_t *slot;
+
+    for (size_t i = 0; i < len; i++)
+        lower[i] = (char) tolower((unsigned char) name[i]);
+    lower[len] = '\0';
+    reserve(&comp_index, ncomps, comp_key);
+    slot = lookup(&comp_index, lower, comp_key);
+    if (*slot < 0) {
+        if (ncomps == comps_cap) {
+            comps_cap = comps_cap > 0 ? comps_cap * 2 : INIT_DIRS;
+            if ((comps = realloc(comps, comps_cap * sizeof(struct component))) == NULL ||
+                (comp_masks = realloc(comp_masks, comps_cap * sizeof(uint64_t))) == NULL)
+                app_error("out of space!!");
+        }
+        c = &comps[ncomps];
+        if ((c->name = strdup(lower)) == NULL)
+            app_error("out of space!!");
+        c->dirs = NULL;
+        c->ndirs = c->cap = 0;
+        comp_masks[ncomps] = mask_of(lower);
+        *slot = ncomps++;
+    }
+    c = &comps[*slot];
+    if (c->ndirs == c->cap) {
+        c->cap = c->cap > 0 ? c->cap * 2 : 4;
+        if ((c->dirs = realloc(c->dirs, c->cap * sizeof(uint32_t))) == NULL)
+            app_error("out of space!!");
+    }
+    c->dirs[c->ndirs++] = d << 1 | (last ? 1 : 0);
+}
+
+/* add_dir - Add count visits to path, the last at time last */
+void add_dir(const char *path, double count, time_t last)
+{
+    int32_t *slot;
+    struct dir_record *d;
+    const char *p, *end;
+
+    reserve(&dir_index, ndirs, dir_key);
+    slot = lookup(&dir_index, path, dir_key);
+    if (*slot >= 0) {
+        d = &dirs[*slot];
+        d->count += count;
+        if (last > d->last)
+            d->last = last;
+        return;
+    }
+    if (ndirs == dirs_cap) {
+        dirs_cap = dirs_cap > 0 ? dirs_cap * 2 : INIT_DIRS;
+        if ((dirs = realloc(dirs, dirs_cap * sizeof(struct dir_record))) == NULL ||
+            (quality = realloc(quality, dirs_cap)) == NULL ||
+            (touched = realloc(touched, dirs_cap * sizeof(uint32_t))) == NULL)
+            app_error("out of space!!");
+    }
+    d = &dirs[ndirs];
+    if ((d->path = strdup(path)) == NULL)
+        app_error("out of space!!");
+    d->count = count;
+    d->last = last;
+    quality[ndirs] = 0;
+    *slot = ndirs;
+    for (p = path; *p != '\0'; p = end) {
+        while (*p == '/')
+            p++;
+        if ((end = strchrnul(p, '/')) > p)
+            add_component(p, end - p, ndirs, strspn(end, "/") == strlen(end));
+    }
+    ndirs++;
+}
+
+/* compact_dirs - Rewrite the file with one line per directory, aging the counts */
+static void compact_dirs(void)
+{
+    char tmp[4096 + 8];
+    double total = 0;
+    FILE *fp;
+    int fd;
+
+    for (int i = 0; i < ndirs; i++)
+        total += dirs[i].count;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dirs_file);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0 ||
+        (fp = fdopen(fd, "w")) == NULL)
+        return;
+    for (int i = 0; i < ndirs; i++) {
+        if (total > MAX_RANK)
+            dirs[i].count *= 0.9 * MAX_RANK / total;
+        if (dirs[i].count >= 1)
+            fprintf(fp, "%.2f\t%ld\t%s\n", dirs[i].count, (long) dirs[i].last, dirs[i].path);
+    }
+    if (fclose(fp) != 0 || rename(tmp, dirs_file) < 0)
+        unlink(tmp);
+}
+
+/* reopen - Open the file again if another session compacted it under us */
+static void reopen(void)
+{
+    struct stat ours, theirs;
+    if (dirs_fd >= 0 && fstat(dirs_fd, &ours) == 0 && stat(dirs_file, &theirs) == 0 &&
+        ours.st_ino == theirs.st_ino && ours.st_dev == theirs.st_dev)
+        return;
+    if (dirs_fd >= 0)
+        close(dirs_fd);
+    dirs_fd = open(dirs_file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+}
+
+/*
+ * open_dirs - Load the visited directories from filename (~/.tsh_dirs by
+ *     default) and append the visits from now on to it. Without it,
+ *     visits are only kept in memory.
+ */
+int open_dirs(const char *filename)
+{
+    char path[4096];
+    char *line = NULL;
+    size_t size = 0;
+    long lines = 0;
+    FILE *fp;
+
+    if (filename == NULL) {
+        snprintf(path, sizeof(path), "%s/%s", get_home_dir(), DIRS_FILE);
+        filename = path;
+    }
+    free(dirs_file);
+    if ((dirs_file = strdup(filename)) == NULL)
+        app_error("out of space!!");
+    reopen();
+    if (dirs_fd < 0)
+        return -1;
+    flock(dirs_fd, LOCK_EX);
+    if ((fp = fopen(dirs_file, "r")) != NULL) {
+        while (getline(&line, &size, fp) > 0) {
+            char *tab1, *tab2;
+            line[strcspn(line, "\n")] = '\0';
+            if ((tab1 = strchr(line, '\t')) != NULL && (tab2 = strchr(tab1 + 1, '\t')) != NULL &&
+                tab2[1] == '/') {
+                add_dir(tab2 + 1, atof(line), (time_t) atol(tab1 + 1));
+                lines++;
+            }
+        }
+        free(line);
+        fclose(fp);
+    }
+    if (lines > 2 * ndirs + INIT_DIRS) {
+        compact_dirs();
+        reopen();
+    }
+    flock(dirs_fd, LOCK_UN);
+    return 0;
+}
+
+/* record_dir - Count a visit to path, which should be absolute */
+void record_dir(const char *path)
+{
+    time_t now = time(NULL);
+    add_dir(path, 1, now);
+    if (dirs_file != NULL) {
+        reopen();
+        if (dirs_fd >= 0)
+            dprintf(dirs_fd, "1\t%ld\t%s\n", (long) now, path);
+    }
+}
+
+/* frecency - Visits, weighted by how long ago the last one was */
+static double frecency(const struct dir_record *d, time_t now)
+{
+    time_t age = now - d->last;
+    if (age < 3600)
+        return d->count * 4;
+    if (age < 86400)
+        return d->count * 2;
+    if (age < 604800)
+        return d->count / 2;
+    return d->count / 4;
+}
+
+/* in_order - Returns true if query's characters are in s, in order */
+static int in_order(const char *query, const char *s)
+{
+    for (; *query != '\0' && *s != '\0'; s++) {
+        if (*s == *query)
+            query++;
+    }
+    return *query == '\0';
+}
+
+/*
+ * split_words - Split query into lower case words in buf; returns how
+ *     many. The last one is looked up, the others filter the paths.
+ */
+static int split_words(const char *query, char *buf, char **words)
+{
+    int n = 0;
+    while (*query != '\0') {
+        while (*query == ' ' || *query == '\t')
+            query++;
+        if (*query == '\0')
+            break;
+        if (n < MAX_WORDS)
+            words[n++] = buf;
+        else
+            *buf++ = ' ';
+        while (*query != '\0' && *query != ' ' && *query != '\t')
+            *buf++ = (char) tolower((unsigned char) *query++);
+        *buf++ = '\0';
+    }
+    return n;
+}
+
+/* has_words - Returns true if path has the n words, in order */
+static int has_words(const char *path, char **words, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if ((path = strcasestr(path, words[i])) == NULL)
+            return 0;
+        path += strlen(words[i]);
+    }
+    return 1;
+}
+
+/* mark - Give the directories of component c the quality of a match */
+static int mark(const struct component *c, uint8_t in_last, uint8_t in_other, int n)
+{
+    for (uint32_t i = 0; i < c->ndirs; i++) {
+        uint32_t d = c->dirs[i] >> 1;
+        uint8_t q = c->dirs[i] & 1 ? in_last : in_other;
+        if (quality[d] == 0)
+            touched[n++] = d;
+        if (q > quality[d])
+            quality[d] = q;
+    }
+    return n;
+}
+
+/*
+ * match_components - Give every directory with a component matching word
+ *     its best quality: 8 if its last component begins with it, 5 if
+ *     another one does, 4 if it's in the last one, 3 if it's in another,
+ *     2 if its characters are in order in the last one, 1 if in another.
+ *     Returns how many directories it touched.
+ */
+static int match_components(const char *word)
+{
+    uint64_t m = mask_of(word);
+    int n = 0;
+    const char *found;
+    for (int i = 0; i < ncomps; i++) {
+        if ((m & ~comp_masks[i]) != 0)
+            continue;
+        if ((found = strstr(comps[i].name, word)) != NULL)
+            n = found == comps[i].name ? mark(&comps[i], 8, 5, n) : mark(&comps[i], 4, 3, n);
+        else if (in_order(word, comps[i].name))
+            n = mark(&comps[i], 2, 1, n);
+    }
+    return n;
+}
+
+struct jump
+{
+    double score;
+    const char *name;       /* what matched: an alias or a path */
+    const char *path;
+};
+
+/* rank - Keep the max best jumps in top, best first; returns how many */
+static int rank(struct jump *top, int n, int max, struct jump j)
+{
+    int i;
+    if (n == max && j.score <= top[n - 1].score)
+        return n;
+    if (n < max)
+        n++;
+    for (i = n - 1; i > 0 && top[i - 1].score < j.score; i--)
+        top[i] = top[i - 1];
+    top[i] = j;
+    return n;
+}
+
+/* find_jumps - The max best matches of query, bookmarks and directories */
+static int find_jumps(const char *query, struct jump *top, int max)
+{
+    char buf[strlen(query) + 1];
+    char *words[MAX_WORDS];
+    char *last;
+    time_t now = time(NULL);
+    int n = 0, nwords, ntouched, count, q;
+    arena a;
+    char **names;
+
+    if ((nwords = split_words(query, buf, words)) == 0)
+        return 0;
+    last = words[--nwords];
+    ntouched = match_components(last);
+    for (int i = 0; i < ntouched; i++) {
+        struct dir_record *d = &dirs[touched[i]];
+        q = quality[touched[i]];
+        quality[touched[i]] = 0;
+        if (d->count > 0 && has_words(d->path, words, nwords))
+            n = rank(top, n, max, (struct jump) {q * frecency(d, now), d->path, d->path});
+    }
+    a = create_arena(0);
+    names = bookmark_names(&count, a);
+    for (int i = 0; i < count; i++) {
+        const char *path = get_bookmark(names[i]);
+        const char *found;
+        double f = 1;
+        int d;
+        if ((found = strcasestr(names[i], last)) != NULL)
+            q = found == names[i] ? 8 : 4;
+        else if (in_order(last, names[i]))
+            q = 2;
+        else
+            continue;
+        if (path == NULL || !has_words(path, words, nwords))
+            continue;
+        if ((d = find_dir(path)) >= 0)
+            f += frecency(&dirs[d], now);
+        n = rank(top, n, max, (struct jump) {q * f * BOOKMARK_BOOST, names[i], path});
+    }
+    dispose_arena(a);
+    return n;
+}
+
+/*
+ * jump_dir - Returns the best match of query, the directory of a bookmark
+ *     or a visited directory, or NULL if nothing matches. A directory that
+ *     is gone is forgotten and the next best tried.
+ */
+const char *jump_dir(const char *query)
+{
+    struct jump top[JUMP_TRIES];
+    struct stat sb;
+    int n = find_jumps(query, top, JUMP_TRIES);
+    int d;
+    for (int i = 0; i < n; i++) {
+        if (stat(top[i].path, &sb) == 0 && S_ISDIR(sb.st_mode))
+            return top[i].path;
+        if ((d = find_dir(top[i].path)) >= 0)
+            dirs[d].count = 0;
+    }
+    return NULL;
+}
+
+/* list_jumps - Print the max best matches of query, with their scores */
+int list_jumps(int output_fd, const char *query, int max)
+{
+    struct jump top[max];
+    int n = find_jumps(query, top, max);
+    fflush(stdout);
+    for (int i = 0; i < n; i++) {
+        if (top[i].name != top[i].path)
+            dprintf(output_fd, "%10.1f  %s => %s\n", top[i].score, top[i].name, top[i].path);
+        else
+            dprintf(output_fd, "%10.1f  %s\n", top[i].score, top[i].path);
+    }
+    return n;
+}
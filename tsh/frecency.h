@@ -0,0 +1,16 @@
+#ifndef OS_HW_FRECENCY_H
+#define OS_HW_FRECENCY_H
+
+#include <time.h>
+
+int open_dirs(const char *filename);
+
+void record_dir(const char *path);
+
+void add_dir(const char *path, double count, time_t last);
+
+const char *jump_dir(const char *query);
+
+int list_jumps(int output_fd, const char *query, int max);
+
+#endif //OS_HW_FRECENCY_H
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "history.h"
+#include "bookmark.h"
+#include "errmsg.h"
+
+#define HISTORY_FILE ".tsh_history"
+#define INDEX_SUFFIX ".idx"
+#define LIST_BUF     (64 << 10)    /* output buffer of list_history */
+#define MEM_HISTORY  256           /* entries kept by the in-memory fallback */
+
+/*
+ * The history is two append-only files: the log, one command line per
+ * '\n'-terminated line, and the index, the uint64 offset of each line in
+ * the log. Both are mapped read-only, so entry n is found in O(1) without
+ * reading the log at startup, whatever its size.
+ *
+ * Appends hold flock on the log, write the line, then its offset: a
+ * reader never sees an index entry whose line isn't there yet. Other
+ * sessions keep appending; the maps are refreshed when an entry past
+ * them is asked for. A crash between the two writes leaves a line
+ * without an index entry (or a torn line), which open_history repairs.
+ *
+ * If the files can't be opened the history is kept in memory instead,
+ * as a ring of the last MEM_HISTORY lines; older entries are gone, but
+ * keep their numbers.
+ */
+static int log_fd = -1;
+static int idx_fd = -1;
+static const char *log_map;
+static size_t log_size;     /* mapped size of the log */
+static const uint64_t *idx_map;
+static long idx_count;      /* entries in the mapped index */
+
+/* in-memory fallback */
+static char *mem_lines[MEM_HISTORY];
+static long mem_count;      /* lines ever added */
+
+/* unmap - Drop the maps of the log and the index */
+static void unmap(void)
+{
+    if (log_map != NULL)
+        munmap((void *) log_map, log_size);
+    if (idx_map != NULL)
+        munmap((void *) idx_map, idx_count * sizeof(uint64_t));
+    log_map = NULL;
+    idx_map = NULL;
+    log_size = 0;
+    idx_count = 0;
+}
+
+/* remap - Map the log and the index as they are now */
+static void remap(void)
+{
+    struct stat log_st, idx_st;
+    void *p;
+    unmap();
+    if (fstat(log_fd, &log_st) < 0 || fstat(idx_fd, &idx_st) < 0)
+        return;
+    if (log_st.st_size > 0 && idx_st.st_size >= (off_t) sizeof(uint64_t)) {
+        /* the index is written last, so every line it has is in the log */
+        if ((p = mmap(NULL, idx_st.st_size, PROT_READ, MAP_SHARED, idx_fd, 0)) == MAP_FAILED)
+            return;
+        idx_map = p;
+        idx_count = idx_st.st_size / sizeof(uint64_t);
+        if ((p = mmap(NULL, log_st.st_size, PROT_READ, MAP_SHARED, log_fd, 0)) == MAP_FAILED) {
+            unmap();
+            return;
+        }
+        log_map = p;
+        log_size = log_st.st_size;
+    }
+}
+
+/*
+ * repair - Make the index match the log after a crash: drop index
+ *     entries past the log, index lines that were written without one,
+ *     and cut off a torn last line. Called with the lock held.
+ */
+static void repair(void)
+{
+    struct stat log_st, idx_st;
+    uint64_t off;
+    const char *nl;
+    long n;
+
+    if (fstat(log_fd, &log_st) < 0 || fstat(idx_fd, &idx_st) < 0)
+        return;
+    n = idx_st.st_size / sizeof(uint64_t);
+    if (idx_st.st_size % sizeof(uint64_t) != 0 && ftruncate(idx_fd, n * sizeof(uint64_t)) < 0)
+        return;
+    /* entries must point into the log: find the last good one */
+    while (n > 0 && (pread(idx_fd, &off, sizeof(off), (n - 1) * sizeof(off)) != sizeof(off) ||
+                     off >= (uint64_t) log_st.st_size))
+        n--;
+    if (ftruncate(idx_fd, n * sizeof(uint64_t)) < 0)
+        return;
+    remap();
+    if (log_st.st_size == 0)
+        return;
+    if (log_map == NULL) {   /* no index at all: index the whole log */
+        if ((log_map = mmap(NULL, log_st.st_size, PROT_READ, MAP_SHARED, log_fd, 0)) == MAP_FAILED) {
+            log_map = NULL;
+            return;
+        }
+        log_size = log_st.st_size;
+        off = 0;
+    } else {   /* skip the last indexed line */
+        off = idx_map[idx_count - 1];
+        nl = memchr(log_map + off, '\n', log_size - off);
+        off = nl != NULL ? (uint64_t) (nl - log_map) + 1 : log_size;
+    }
+    while (off < log_size && (nl = memchr(log_map + off, '\n', log_size - off)) != NULL) {
+        if (write(idx_fd, &off, sizeof(off)) != sizeof(off))
+            return;
+        off = (uint64_t) (nl - log_map) + 1;
+    }
+    if (off < log_size && ftruncate(log_fd, off) < 0)  /* a torn last line */
+        return;
+    remap();
+}
+
+/*
+ * open_history - Open the history log (~/.tsh_history by default) and its
+ *     index. Returns -1, and keeps the history in memory, if they can't
+ *     be opened.
+ */
+int open_history(const char *filename)
+{
+    char path[4096];
+    char idx_path[4096 + sizeof(INDEX_SUFFIX)];
+    if (filename == NULL) {
+        snprintf(path, sizeof(path), "%s/%s", get_home_dir(), HISTORY_FILE);
+        filename = path;
+    }
+    snprintf(idx_path, sizeof(idx_path), "%s%s", filename, INDEX_SUFFIX);
+    if ((log_fd = open(filename, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0)
+        return -1;
+    if ((idx_fd = open(idx_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+        close(log_fd);
+        log_fd = -1;
+        return -1;
+    }
+    flock(log_fd, LOCK_EX);
+    repair();
+    flock(log_fd, LOCK_UN);
+    return 0;
+}
+
+/* add_history - Append a command line (its '\n' is optional) */
+void add_history(const char *cmdline)
+{
+    size_t len = strcspn(cmdline, "\n");
+    char *line;
+    off_t off;
+    if (log_fd < 0) {
+        if ((line = strndup(cmdline, len)) == NULL)
+            app_error("out of space!!");
+        free(mem_lines[mem_count % MEM_HISTORY]);   /* the oldest, once the ring is full */
+        mem_lines[mem_count++ % MEM_HISTORY] = line;
+        return;
+    }
+    if ((line = malloc(len + 1)) == NULL)
+        app_error("out of space!!");
+    memcpy(line, cmdline, len);
+    line[len] = '\n';
+    flock(log_fd, LOCK_EX);
+    /* the offset we append at: the lock keeps other sessions out */
+    if ((off = lseek(log_fd, 0, SEEK_END)) >= 0 &&
+        write(log_fd, line, len + 1) == (ssize_t) (len + 1)) {
+        uint64_t off64 = (uint64_t) off;
+        if (write(idx_fd, &off64, sizeof(off64)) != sizeof(off64))
+            repair();
+    }
+    flock(log_fd, LOCK_UN);
+    free(line);
+}
+
+/* history_count - Returns the number of entries, from every session */
+long history_count(void)
+{
+    struct stat st;
+    if (log_fd < 0)
+        return mem_count;
+    if (fstat(idx_fd, &st) == 0 && st.st_size / (off_t) sizeof(uint64_t) != idx_count)
+        remap();
+    return idx_count;
+}
+
+/*
+ * history_entry - Returns entry n (0 is the oldest) in place, without its
+ *     '\n' and not NUL-terminated, and its length in len. It's only good
+ *     until the next history call, which may remap the log.
+ */
+const char *history_entry(long n, size_t *len)
+{
+    uint64_t start;
+    const char *nl;
+    if (log_fd < 0) {
+        if (n < 0 || n >= mem_count || n < mem_count - MEM_HISTORY)
+            return NULL;
+        *len = strlen(mem_lines[n % MEM_HISTORY]);
+        return mem_lines[n % MEM_HISTORY];
+    }
+    if (n >= idx_count)
+        remap();
+    if (n < 0 || n >= idx_count)
+        return NULL;
+    start = idx_map[n];
+    /* up to its '\n', as the log may have a line past it not indexed yet */
+    if (start >= log_size || (nl = memchr(log_map + start, '\n', log_size - start)) == NULL)
+        return NULL;
+    *len = nl - (log_map + start);     /* without the '\n' */
+    return log_map + start;
+}
+
+/*
+ * get_history - Returns entry n as a command line with its '\n', copied
+ *     into a, or NULL if there's no such entry.
+ */
+char *get_history(long n, arena a)
+{
+    const char *s;
+    char *line;
+    size_t len;
+    if ((s = history_entry(n, &len)) == NULL)
+        return NULL;
+    line = alloc_arena(a, len + 2);
+    memcpy(line, s, len);
+    line[len] = '\n';
+    line[len + 1] = '\0';
+    return line;
+}
+
+/*
+ * print_entries - Print count entries numbered from 1: entries[0..count)
+ *     or, if entries is NULL, the ones from first on.
+ */
+static int print_entries(int output_fd, const long *entries, long first, long count)
+{
+    char buf[LIST_BUF];
+    size_t used = 0, len;
+    const char *s;
+    long n;
+    fflush(stdout);
+    for (long i = 0; i < count; i++) {
+        n = entries != NULL ? entries[i] : first + i;
+        if ((s = history_entry(n, &len)) == NULL)
+            continue;   /* gone from the in-memory ring */
+        if (used + len + 32 > sizeof(buf) || len + 32 > sizeof(buf)) {
+            if (write(output_fd, buf, used) < 0)
+                return -1;
+            used = 0;
+        }
+        used += sprintf(buf + used, "%6ld  ", n + 1);
+        if (len + 32 > sizeof(buf)) {   /* too long to buffer */
+            if (write(output_fd, buf, used) < 0 || write(output_fd, s, len) < 0 ||
+                write(output_fd, "\n", 1) < 0)
+                return -1;
+            used = 0;
+            continue;
+        }
+        memcpy(buf + used, s, len);
+        used += len;
+        buf[used++] = '\n';
+    }
+    if (used > 0 && write(output_fd, buf, used) < 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * list_history - Print count entries from first on. Returns -1 if
+ *     output_fd can't be written.
+ */
+int list_history(int output_fd, long first, long count)
+{
+    return print_entries(output_fd, NULL, first, count);
+}
+
+/* list_history_entries - Print the count entries listed in entries */
+int list_history_entries(int output_fd, const long *entries, long count)
+{
+    return print_entries(output_fd, entries, 0, count);
+}
@@ -0,0 +1,22 @@
+#ifndef OS_HW_HISTORY_H
+#define OS_HW_HISTORY_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+int open_history(const char *filename);
+
+void add_history(const char *cmdline);
+
+long history_count(void);
+
+const char *history_entry(long n, size_t *len);
+
+char *get_history(long n, arena a);
+
+int list_history(int output_fd, long first, long count);
+
+int list_history_entries(int output_fd, const long *entries, long count);
+
+#endif //OS_HW_HISTORY_H
@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "histsearch.h"
+#include "history.h"
+#include "errmsg.h"
+
+#define INIT_SLOTS 4096     /* index slots before it has to grow */
+#define INIT_IDS   4        /* ids in a new posting list */
+
+/* trigram keys: 0 marks an empty slot, the start keys come after the rest */
+#define TRI_KEY(s)   ((((uint32_t) (unsigned char) (s)[0] << 16) | \
+                       ((uint32_t) (unsigned char) (s)[1] << 8) | \
+                       (uint32_t) (unsigned char) (s)[2]) + 1)
+#define START_KEY(s) ((1u << 24) + (((uint32_t) (unsigned char) (s)[0] << 8) | \
+                                    (uint32_t) (unsigned char) (s)[1]) + 1)
+
+/* the entries a trigram occurs in, oldest first */
+struct posting
+{
+    uint32_t key;
+    uint32_t n;
+    uint32_t cap;
+    uint32_t *ids;
+};
+
+/*
+ * A trigram index over the history: every three bytes of an entry, plus
+ * its first two bytes as a start key, map to the entries that have them.
+ * A pattern can only be in the entries that have all its trigrams, so a
+ * search walks the shortest of their lists back from the end, checks the
+ * others by binary search, and only reads the entries that pass.
+ *
+ * The index is built on the first search and then kept up as lines are
+ * saved, or added by other sessions; entries are never removed.
+ */
+static struct posting *table;
+static size_t slots;        /* a power of two */
+static size_t used;
+static long indexed = -1;   /* entries in the index, -1 until the first search */
+
+/* slot_of - Returns the slot of key, or the empty one it would go in */
+static struct posting *slot_of(struct posting *t, size_t size, uint32_t key)
+{
+    size_t i = (size_t) (((uint64_t) key * 0x9E3779B97F4A7C15ULL) >> 32) & (size - 1);
+    while (t[i].key != 0 && t[i].key != key)
+        i = (i + 1) & (size - 1);
+    return &t[i];
+}
+
+/* grow - Double the table, keeping it at most half full */
+static void grow(void)
+{
+    size_t size = slots > 0 ? slots * 2 : INIT_SLOTS;
+    struct posting *t;
+    if ((t = calloc(size, sizeof(struct posting))) == NULL)
+        app_error("out of space!!");
+    for (size_t i = 0; i < slots; i++) {
+        if (table[i].key != 0)
+            *slot_of(t, size, table[i].key) = table[i];
+    }
+    free(table);
+    table = t;
+    slots = size;
+}
+
+/* add_id - Add entry id to the list of key, once */
+static void add_id(uint32_t key, uint32_t id)
+{
+    struct posting *p;
+    if (2 * (used + 1) > slots)
+        grow();
+    p = slot_of(table, slots, key);
+    if (p->key == 0) {
+        p->key = key;
+        used++;
+    } else if (p->ids[p->n - 1] == id) {
+        return;
+    }
+    if (p->n == p->cap) {
+        p->cap = p->cap > 0 ? p->cap * 2 : INIT_IDS;
+        if ((p->ids = realloc(p->ids, p->cap * sizeof(uint32_t))) == NULL)
+            app_error("out of space!!");
+    }
+    p->ids[p->n++] = id;
+}
+
+/* lookup - Returns the list of key, or NULL if no entry has it */
+static struct posting *lookup(uint32_t key)
+{
+    struct posting *p;
+    if (slots == 0)     /* no entry was long enough to index */
+        return NULL;
+    p = slot_of(table, slots, key);
+    return p->key != 0 ? p : NULL;
+}
+
+/*
+ * update_history_index - Index the entries saved since the last call.
+ *     Nothing is done until the index is first used.
+ */
+void update_history_index(void)
+{
+    const char *s;
+    size_t len;
+    long count;
+    if (indexed < 0)
+        return;
+    count = history_count();
+    for (; indexed < count; indexed++) {
+        if ((s = history_entry(indexed, &len)) == NULL)
+            continue;
+        if (len >= 2)
+            add_id(START_KEY(s), (uint32_t) indexed);
+        for (size_t i = 0; i + 3 <= len; i++)
+            add_id(TRI_KEY(s + i), (uint32_t) indexed);
+    }
+}
+
+/* matches - Returns true if entry n matches pattern */
+static int matches(long n, const char *pattern, size_t plen, int how)
+{
+    size_t len;
+    const char *s = history_entry(n, &len);
+    if (s == NULL || len < plen)
+        return 0;
+    if (how == MATCH_PREFIX)
+        return memcmp(s, pattern, plen) == 0;
+    return memmem(s, len, pattern, plen) != NULL;
+}
+
+/* has_id - Binary search of p's list for id */
+static int has_id(const struct posting *p, uint32_t id)
+{
+    uint32_t lo = 0, hi = p->n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (p->ids[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < p->n && p->ids[lo] == id;
+}
+
+static int by_length(const void *a, const void *b)
+{
+    const struct posting *p = *(struct posting *const *) a;
+    const struct posting *q = *(struct posting *const *) b;
+    return (p->n > q->n) - (p->n < q->n);
+}
+
+/*
+ * scan_history - Returns the newest entry before entry 'before' that
+ *     matches pattern, reading them one by one, or -1 if there's none.
+ */
+long scan_history(const char *pattern, int how, long before)
+{
+    size_t plen = strlen(pattern);
+    long count = history_count();
+    for (long n = (before < count ? before : count) - 1; n >= 0; n--) {
+        if (matches(n, pattern, plen, how))
+            return n;
+    }
+    return -1;
+}
+
+/*
+ * search_history - Returns the newest entry before entry 'before' that
+ *     starts with (MATCH_PREFIX) or contains (MATCH_SUBSTRING) pattern,
+ *     or -1 if there's none. Patterns too short to have a trigram are
+ *     scanned for instead.
+ */
+long search_history(const char *pattern, int how, long before)
+{
+    size_t plen = strlen(pattern);
+    size_t nkeys = 0;
+    struct posting **lists;
+    struct posting *best = NULL;
+    uint32_t lo, hi, id;
+    long found = -1;
+
+    if (indexed < 0)
+        indexed = 0;
+    update_history_index();
+    if (before > indexed)
+        before = indexed;
+    if (before <= 0)
+        return -1;
+    if (plen < (how == MATCH_PREFIX ? 2 : 3))
+        return scan_history(pattern, how, before);
+    if (table == NULL)      /* no entry has a trigram, so none has the pattern's */
+        return -1;
+
+    if ((lists = malloc((plen + 1) * sizeof(struct posting *))) == NULL)
+        app_error("out of space!!");
+    if (how == MATCH_PREFIX)
+        lists[nkeys++] = lookup(START_KEY(pattern));
+    for (size_t i = 0; i + 3 <= plen; i++)
+        lists[nkeys++] = lookup(TRI_KEY(pattern + i));
+    for (size_t k = 0; k < nkeys; k++) {
+        if (lists[k] == NULL)       /* no entry has this trigram */
+            goto done;
+    }
+    /* shortest first: it's walked, and the next ones reject the most */
+    qsort(lists, nkeys, sizeof(struct posting *), by_length);
+    best = lists[0];
+
+    /* the last id in best before 'before' */
+    lo = 0;
+    hi = best->n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (best->ids[mid] < (uint32_t) before)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    while (lo-- > 0) {
+        size_t k;
+        id = best->ids[lo];
+        for (k = 1; k < nkeys && has_id(lists[k], id); k++)
+            ;
+        if (k == nkeys && matches(id, pattern, plen, how)) {
+            found = id;
+            break;
+        }
+    }
+done:
+    free(lists);
+    return found;
+}
@@ -0,0 +1,14 @@
+#ifndef OS_HW_HISTSEARCH_H
+#define OS_HW_HISTSEARCH_H
+
+/* How search_history matches a pattern */
+#define MATCH_PREFIX    0
+#define MATCH_SUBSTRING 1
+
+void update_history_index(void);
+
+long search_history(const char *pattern, int how, long before);
+
+long scan_history(const char *pattern, int how, long before);
+
+#endif //OS_HW_HISTSEARCH_H
@@ -3,12 +3,147 @@
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
 #include "job.h"
 #include "sigutil.h"
+#include "reactor.h"
+#include "pipesize.h"
+#include "trace.h"
+#include "errmsg.h"
 
-/* next job ID to allocate */
-int nextjid = 1;
+#define INIT_JID_CAP   64    /* initial size of the jid index */
+#define INIT_PID_CAP   128   /* initial size of the pid index, a power of 2 */
+#define JOB_CHUNK      64    /* job records allocated at a time */
+
+#define PID_EMPTY      0     /* pid index slot never used */
+#define PID_DELETED    (-1)  /* pid index slot freed by deletejob */
+
+struct pid_slot
+{
+    pid_t pid;
+    struct job_t *job;
+};
+
+/*
+ * The job list. Every job is indexed twice: by jid in a directly indexed
+ * array, and by pid in an open addressing hash table. Records and jids are
+ * recycled through free lists, so deletejob never allocates or frees
+ * memory. The list is only changed by the shell's own code, reaping
+ * included, which the reactor does between commands.
+ *
+ * A pipeline is one job with a process per stage, all in the process
+ * group of the first. Each stage's pid is in the pid index until the job
+ * is deleted, and the job ends when its last stage is reaped.
+ */
+struct job_list_record
+{
+    struct job_t **by_jid;      /* jid => job, slot 0 unused */
+    int jid_cap;                /* size of by_jid */
+    int max_jid;                /* largest jid ever handed out */
+    int *free_jids;             /* stack of released jids */
+    int nfree_jids;
+    struct pid_slot *by_pid;    /* pid => job */
+    unsigned int pid_cap;       /* size of by_pid */
+    unsigned int pid_used;      /* live and deleted slots of by_pid */
+    struct job_t *free_jobs;    /* recycled job records */
+    struct job_t *fg;           /* the foreground job, if any */
+    int count;                  /* number of jobs */
+    int npids;                  /* live pids in by_pid */
+    int running_bg;             /* jobs in the BG state */
+    int watched;                /* pipes watched for pipesz */
+};
+
+static struct job_list_record job_list_data;
+
+/* The job list */
+job_list jobs = &job_list_data;
+
+/* report shell CPU time spent in waitfg */
+int waitfg_report = 0;
+
+/* usage of the last foreground job that finished, for the time builtin */
+static struct job_usage fg_usage;
+static pid_t fg_usage_pid;
+
+/* and the wait status of each of its stages, for pipestatus */
+static int *fg_status;
+static int nfg_status;
+static int fg_status_cap;
+
+/* pid_hash - Home slot of pid in the pid index */
+static unsigned int pid_hash(pid_t pid, unsigned int cap)
+{
+    return ((unsigned int) pid * 2654435761U) & (cap - 1);
+}
+
+/* find_pid_slot - Returns the pid index slot holding pid, or NULL */
+static struct pid_slot *find_pid_slot(job_list jobs, pid_t pid)
+{
+    unsigned int i = pid_hash(pid, jobs->pid_cap);
+    while (jobs->by_pid[i].pid != PID_EMPTY) {
+        if (jobs->by_pid[i].pid == pid)
+            return &jobs->by_pid[i];
+        i = (i + 1) & (jobs->pid_cap - 1);
+    }
+    return NULL;
+}
+
+/* insert_pid - Add pid => job to the pid index, which must have room */
+static void insert_pid(job_list jobs, pid_t pid, struct job_t *job)
+{
+    unsigned int i = pid_hash(pid, jobs->pid_cap);
+    while (jobs->by_pid[i].pid > 0)
+        i = (i + 1) & (jobs->pid_cap - 1);
+    if (jobs->by_pid[i].pid == PID_EMPTY)
+        jobs->pid_used++;
+    jobs->by_pid[i].pid = pid;
+    jobs->by_pid[i].job = job;
+}
+
+/* grow_pid_index - Rehash the pid index into cap slots, dropping deleted ones */
+static void grow_pid_index(job_list jobs, unsigned int cap)
+{
+    struct pid_slot *old = jobs->by_pid;
+    unsigned int old_cap = jobs->pid_cap;
+    if ((jobs->by_pid = calloc(cap, sizeof(struct pid_slot))) == NULL)
+        app_error("out of space!!");
+    jobs->pid_cap = cap;
+    jobs->pid_used = 0;
+    for (unsigned int i = 0; i < old_cap; i++)
+        if (old[i].pid > 0)
+            insert_pid(jobs, old[i].pid, old[i].job);
+    free(old);
+}
+
+/* grow_jid_index - Make room for jids up to cap - 1 */
+static void grow_jid_index(job_list jobs, int cap)
+{
+    struct job_t **by_jid;
+    int *free_jids;
+    if ((by_jid = realloc(jobs->by_jid, cap * sizeof(struct job_t *))) == NULL ||
+        (free_jids = realloc(jobs->free_jids, cap * sizeof(int))) == NULL)
+        app_error("out of space!!");
+    memset(by_jid + jobs->jid_cap, 0, (cap - jobs->jid_cap) * sizeof(struct job_t *));
+    jobs->by_jid = by_jid;
+    jobs->free_jids = free_jids;
+    jobs->jid_cap = cap;
+}
+
+/* alloc_jobs - Put a new chunk of job records on the free list */
+static void alloc_jobs(job_list jobs)
+{
+    struct job_t *chunk;
+    if ((chunk = calloc(JOB_CHUNK, sizeof(struct job_t))) == NULL)
+        app_error("out of space!!");
+    for (int i = 0; i < JOB_CHUNK; i++) {
+        chunk[i].next_free = jobs->free_jobs;
+        jobs->free_jobs = &chunk[i];
+    }
+}
 
 /* clearjob - Clear the entries in a job struct */
 void clearjob(struct job_t *job)
@@ -20,160 +155,545 @@ void clearjob(struct job_t *job)
 }
 
 /* initjobs - Initialize the job list */
-void initjobs(struct job_t *jobs)
+void initjobs(job_list jobs)
 {
-    int i;
-    for (i = 0; i < MAXJOBS; i++)
-        clearjob(&jobs[i]);
+    memset(jobs, 0, sizeof(struct job_list_record));
+    grow_jid_index(jobs, INIT_JID_CAP);
+    grow_pid_index(jobs, INIT_PID_CAP);
+    alloc_jobs(jobs);
 }
 
-/* maxjid - Returns largest allocated job ID */
-int maxjid(struct job_t *jobs)
+/* reserve_pid - Make room in the pid index for one more pid */
+static void reserve_pid(job_list jobs)
 {
-    int i, max = 0;
-    for (i = 0; i < MAXJOBS; i++)
-        if (jobs[i].jid > max)
-            max = jobs[i].jid;
-    return max;
+    if ((jobs->pid_used + 1) * 4 > jobs->pid_cap * 3)  /* rehash, growing if the live pids need it */
+        grow_pid_index(jobs, (unsigned int) (jobs->npids + 1) * 4 > jobs->pid_cap ? jobs->pid_cap * 2 : jobs->pid_cap);
 }
 
 /* addjob - Add a job to the job list */
-int addjob(struct job_t *jobs, pid_t pid, int state, const char *cmdline)
+int addjob(job_list jobs, pid_t pid, int state, const char *cmdline)
 {
-    int i;
+    return addpipeline(jobs, &pid, NULL, 1, state, cmdline);
+}
+
+/*
+ * addpipeline - Add a job of n stages, whose processes are pids (0 for a
+ *     stage that couldn't be started). watch_fds[k] (NULL if none) is the
+ *     read end of the pipe after stage k kept for pipesz, -1 if it isn't
+ *     watched; the job owns it from now on. The job's pid is the first
+ *     stage's that started, its process group.
+ */
+int addpipeline(job_list jobs, const pid_t *pids, const int *watch_fds, int n,
+                int state, const char *cmdline)
+{
+    struct job_t *job;
+    struct job_stage *stages;
+    pid_t pid = 0;
+    size_t len;
+    char *buf;
+    for (int i = 0; i < n && pid == 0; i++)
+        pid = pids[i];
     if (pid < 1)
         return 0;
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].pid == 0) {
-            jobs[i].pid = pid;
-            jobs[i].state = state;
-            jobs[i].jid = nextjid++;
-            if (nextjid > MAXJOBS)
-                nextjid = 1;
-            strcpy(jobs[i].cmdline, cmdline);
-            return 1;
+    if (jobs->free_jobs == NULL)
+        alloc_jobs(jobs);
+    if (jobs->nfree_jids == 0 && jobs->max_jid + 1 >= jobs->jid_cap)
+        grow_jid_index(jobs, jobs->jid_cap * 2);
+
+    job = jobs->free_jobs;
+    jobs->free_jobs = job->next_free;
+    job->pid = pid;
+    job->jid = jobs->nfree_jids > 0 ? jobs->free_jids[--jobs->nfree_jids] : ++jobs->max_jid;
+    job->state = UNDEF;
+    len = strlen(cmdline) + 1;
+    if (len > job->cmdline_cap) {   /* the record keeps its buffers when recycled */
+        if ((buf = realloc(job->cmdline, len)) == NULL)
+            app_error("out of space!!");
+        job->cmdline = buf;
+        job->cmdline_cap = len;
+    }
+    memcpy(job->cmdline, cmdline, len);
+    if (n > job->stages_cap) {
+        if ((stages = realloc(job->stages, n * sizeof(struct job_stage))) == NULL)
+            app_error("out of space!!");
+        job->stages = stages;
+        job->stages_cap = n;
+    }
+    job->nstages = n;
+    job->running = 0;
+    for (int i = 0; i < n; i++) {
+        struct job_stage *st = &job->stages[i];
+        st->pid = pids[i] > 0 ? pids[i] : 0;
+        st->pidfd = -1;
+        st->running = st->pid > 0;
+        st->status = st->running ? 0 : W_EXITCODE(1, 0);
+        st->watch_fd = i > 0 && watch_fds != NULL ? watch_fds[i - 1] : -1;
+        st->full = 0;
+        jobs->watched += st->watch_fd >= 0;
+        if (st->running) {
+            reserve_pid(jobs);
+            insert_pid(jobs, st->pid, job);
+            jobs->npids++;
+            job->running++;
         }
     }
-    printf("Tried to create too many jobs\n");
-    return 0;
+    memset(&job->usage, 0, sizeof(struct job_usage));
+    clock_gettime(CLOCK_MONOTONIC, &job->usage.start);
+    jobs->by_jid[job->jid] = job;
+    jobs->count++;
+    setjobstate(jobs, job, state);
+    return 1;
 }
 
-/* deletejob - Delete a job whose PID=pid from the job list */
-int deletejob(struct job_t *jobs, pid_t pid)
+/*
+ * addstage - Add pid, just started, as one more stage of the job whose
+ *     PID is job_pid. Returns the stage's index, -1 if there's no such job.
+ */
+int addstage(job_list jobs, pid_t job_pid, pid_t pid)
 {
-    int i;
-    if (pid < 1)
+    struct job_t *job = getjobpid(jobs, job_pid);
+    struct job_stage *stages, *st;
+    if (job == NULL || pid < 1)
+        return -1;
+    if (job->nstages == job->stages_cap) {
+        if ((stages = realloc(job->stages, 2 * job->stages_cap * sizeof(struct job_stage))) == NULL)
+            app_error("out of space!!");
+        job->stages = stages;
+        job->stages_cap *= 2;
+    }
+    st = &job->stages[job->nstages];
+    st->pid = pid;
+    st->pidfd = -1;
+    st->running = 1;
+    st->status = 0;
+    st->watch_fd = -1;
+    st->full = 0;
+    reserve_pid(jobs);
+    insert_pid(jobs, pid, job);
+    jobs->npids++;
+    job->running++;
+    return job->nstages++;
+}
+
+/* unwatch_stage - Stop watching the pipe into stage i, and its pidfd */
+static void unwatch_stage(job_list jobs, struct job_t *job, int i)
+{
+    struct job_stage *st = &job->stages[i];
+    if (st->watch_fd >= 0) {
+        unwatch_pipe(&st->watch_fd, i - 1);
+        jobs->watched--;
+    }
+    if (st->pidfd >= 0) {   /* closing it takes it out of the reactor */
+        close(st->pidfd);
+        st->pidfd = -1;
+    }
+}
+
+/* deletejob - Delete a job whose PID=pid (or a stage's) from the job list */
+int deletejob(job_list jobs, pid_t pid)
+{
+    struct pid_slot *slot;
+    struct job_t *job;
+    if (pid < 1 || (slot = find_pid_slot(jobs, pid)) == NULL)
         return 0;
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].pid == pid) {
-            clearjob(&jobs[i]);
-            nextjid = maxjid(jobs) + 1;
-            return 1;
+    job = slot->job;
+    for (int i = 0; i < job->nstages; i++) {
+        if (job->stages[i].pid > 0 && (slot = find_pid_slot(jobs, job->stages[i].pid)) != NULL &&
+            slot->job == job) {
+            slot->pid = PID_DELETED;
+            jobs->npids--;
         }
+        unwatch_stage(jobs, job, i);
     }
-    return 0;
+    setjobstate(jobs, job, UNDEF);
+    jobs->by_jid[job->jid] = NULL;
+    if (--jobs->count == 0) {  /* start over at jid 1 */
+        jobs->max_jid = 0;
+        jobs->nfree_jids = 0;
+    } else {
+        jobs->free_jids[jobs->nfree_jids++] = job->jid;
+    }
+    clearjob(job);
+    job->next_free = jobs->free_jobs;
+    jobs->free_jobs = job;
+    return 1;
 }
 
-/* fgpid - Return PID of current foreground job, 0 if no such job */
-pid_t fgpid(struct job_t *jobs)
+/*
+ * finishjob - Record the wait status and the resource usage (NULL if
+ *     unknown) wait4 reported for pid, a process of a job, which has
+ *     exited. Called when it's reaped, before deletejob. Returns how many
+ *     of the job's stages are still running, -1 if pid isn't in a job.
+ */
+int finishjob(job_list jobs, pid_t pid, int status, const struct rusage *ru)
 {
+    struct job_t *job = getjobpid(jobs, pid);
+    struct job_stage *st = NULL;
+    struct job_usage *u;
     int i;
-    for (i = 0; i < MAXJOBS; i++)
-        if (jobs[i].state == FG)
-            return jobs[i].pid;
+    if (job == NULL)
+        return -1;
+    for (i = 0; i < job->nstages; i++) {
+        if (job->stages[i].pid == pid && job->stages[i].running)
+            st = &job->stages[i];
+    }
+    if (st == NULL)
+        return job->running;
+    i = (int) (st - job->stages);
+    st->running = 0;
+    st->status = status;
+    job->running--;
+    unwatch_stage(jobs, job, i);
+    u = &job->usage;
+    if (ru != NULL) {   /* a pipeline used what all its stages did */
+        timeradd(&u->utime, &ru->ru_utime, &u->utime);
+        timeradd(&u->stime, &ru->ru_stime, &u->stime);
+        if (ru->ru_maxrss > u->maxrss)
+            u->maxrss = ru->ru_maxrss;
+        u->nvcsw += ru->ru_nvcsw;
+        u->nivcsw += ru->ru_nivcsw;
+    }
+    if (job->running > 0)
+        return job->running;
+    clock_gettime(CLOCK_MONOTONIC, &u->end);
+    if (tracing() && job->nstages > 1) {
+        int result = 0;     /* like a pipeline process's exit status */
+        for (i = 0; i < job->nstages; i++) {
+            status = job->stages[i].status;
+            result |= WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        }
+        trace_begin("pipeline");
+        trace_int("stages", job->nstages);
+        trace_int("status", result);
+        trace_int("jid", job->jid);
+        trace_end();
+    }
+    if (job->state == FG) {
+        fg_usage = *u;
+        fg_usage_pid = job->pid;
+        if (job->nstages > fg_status_cap) {
+            fg_status_cap = job->nstages;
+            if ((fg_status = realloc(fg_status, fg_status_cap * sizeof(int))) == NULL)
+                app_error("out of space!!");
+        }
+        nfg_status = job->nstages;
+        for (i = 0; i < job->nstages; i++)
+            fg_status[i] = job->stages[i].status;
+    }
+    return 0;
+}
+
+/* watching_pipes - Returns true if some running pipeline's pipes are watched */
+int watching_pipes(job_list jobs)
+{
+    return jobs->watched > 0;
+}
+
+/* grow_job_pipes - Sample every watched pipe, growing those that keep filling up */
+void grow_job_pipes(job_list jobs)
+{
+    struct job_t *job;
+    for (int i = 1; i <= jobs->max_jid; i++) {
+        if ((job = jobs->by_jid[i]) == NULL)
+            continue;
+        for (int k = 1; k < job->nstages; k++) {
+            if (job->stages[k].watch_fd >= 0)
+                grow_full_pipe(job->stages[k].watch_fd, &job->stages[k].full);
+        }
+    }
+}
+
+/* setfgstatus - Record the exit status of a builtin the shell ran, for pipestatus */
+void setfgstatus(int status)
+{
+    if (fg_status_cap == 0) {
+        fg_status_cap = 1;
+        if ((fg_status = malloc(sizeof(int))) == NULL)
+            app_error("out of space!!");
+    }
+    nfg_status = 1;
+    fg_status[0] = W_EXITCODE(status, 0);
+}
+
+/*
+ * print_pipestatus - Print the exit status of each stage of the last
+ *     foreground job that ran to the end (128 + the signal for one that
+ *     was killed), or of the builtin run since. Returns -1 if output_fd
+ *     can't be written.
+ */
+int print_pipestatus(int output_fd)
+{
+    char buf[16];
+    int status;
+    fflush(stdout);
+    for (int i = 0; i < nfg_status; i++) {
+        status = fg_status[i];
+        sprintf(buf, "%s%d", i > 0 ? " " : "",
+                WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+        if (write(output_fd, buf, strlen(buf)) < 0)
+            return -1;
+    }
+    return nfg_status > 0 && write(output_fd, "\n", 1) < 0 ? -1 : 0;
+}
+
+/*
+ * stagestatus - Get the wait status of stage i of the job whose PID is
+ *     job_pid. Returns 1 while it's running, 0 once it has exited, even
+ *     if that ended the job, as long as it was the last foreground job
+ *     to run to the end, and -1 if it isn't known (e.g. it was interrupted).
+ */
+int stagestatus(job_list jobs, pid_t job_pid, int i, int *status)
+{
+    struct job_t *job = getjobpid(jobs, job_pid);
+    if (job != NULL && job->pid == job_pid) {
+        if (i >= job->nstages)
+            return -1;
+        if (job->stages[i].running)
+            return 1;
+        *status = job->stages[i].status;
+        return 0;
+    }
+    if (job_pid != fg_usage_pid || i >= nfg_status)
+        return -1;
+    *status = fg_status[i];
+    return 0;
+}
+
+/* getfgusage - Get the usage of foreground job pid, -1 if it isn't known */
+int getfgusage(pid_t pid, struct job_usage *usage)
+{
+    if (pid != fg_usage_pid)
+        return -1;
+    *usage = fg_usage;
     return 0;
 }
 
+/* setjobstate - Change the state of a job, keeping track of the FG job */
+void setjobstate(job_list jobs, struct job_t *job, int state)
+{
+    if (jobs->fg == job)
+        jobs->fg = NULL;
+    jobs->running_bg += (state == BG) - (job->state == BG);
+    job->state = state;
+    if (state == FG)
+        jobs->fg = job;
+}
+
+/* fgpid - Return PID of current foreground job, 0 if no such job */
+pid_t fgpid(job_list jobs)
+{
+    return jobs->fg != NULL ? jobs->fg->pid : 0;
+}
+
 /* getjobpid  - Find a job (by PID) on the job list */
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid)
+struct job_t *getjobpid(job_list jobs, pid_t pid)
 {
-    int i;
+    struct pid_slot *slot;
     if (pid < 1)
         return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-        if (jobs[i].pid == pid)
-            return &jobs[i];
-    return NULL;
+    slot = find_pid_slot(jobs, pid);
+    return slot != NULL ? slot->job : NULL;
 }
 
 /* getjobjid  - Find a job (by JID) on the job list */
-struct job_t *getjobjid(struct job_t *jobs, int jid)
+struct job_t *getjobjid(job_list jobs, int jid)
 {
-    int i;
-    if (jid < 1)
+    if (jid < 1 || jid > jobs->max_jid)
         return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-        if (jobs[i].jid == jid)
-            return &jobs[i];
-    return NULL;
+    return jobs->by_jid[jid];
 }
 
 /* pid2jid - Map process ID to job ID */
 int pid2jid(pid_t pid)
 {
-    int i;
-    if (pid < 1)
-        return 0;
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].pid == pid) {
-            return jobs[i].jid;
-        }
-    }
+    struct job_t *job = getjobpid(jobs, pid);
+    return job != NULL ? job->jid : 0;
+}
+
+/* ts_sub_ms - Returns a - b in milliseconds */
+static long ts_sub_ms(struct timespec a, struct timespec b)
+{
+    return (a.tv_sec - b.tv_sec) * 1000L + (a.tv_nsec - b.tv_nsec) / 1000000L;
+}
+
+/*
+ * read_proc_usage - Fill in the usage of a running job from /proc: the cpu
+ *     time of its process and the children it has reaped, its peak RSS and
+ *     its context switches. Returns -1 if pid is gone.
+ */
+static int read_proc_usage(pid_t pid, struct job_usage *u)
+{
+    char path[64], buf[4096];
+    unsigned long utime, stime;
+    long cutime, cstime, ticks = sysconf(_SC_CLK_TCK);
+    char *p;
+    ssize_t n;
+    int fd;
+
+    sprintf(path, "/proc/%d/stat", pid);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0 || (buf[n] = '\0', p = strrchr(buf, ')')) == NULL ||
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld",
+               &utime, &stime, &cutime, &cstime) != 4)
+        return -1;
+    utime += cutime;
+    stime += cstime;
+    u->utime.tv_sec = (time_t) (utime / ticks);
+    u->utime.tv_usec = (suseconds_t) (utime % ticks * 1000000 / ticks);
+    u->stime.tv_sec = (time_t) (stime / ticks);
+    u->stime.tv_usec = (suseconds_t) (stime % ticks * 1000000 / ticks);
+
+    sprintf(path, "/proc/%d/status", pid);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+    if ((p = strstr(buf, "VmHWM:")) != NULL)
+        u->maxrss = strtol(p + 6, NULL, 10);
+    if ((p = strstr(buf, "\nvoluntary_ctxt_switches:")) != NULL)
+        u->nvcsw = strtol(p + 26, NULL, 10);
+    if ((p = strstr(buf, "nonvoluntary_ctxt_switches:")) != NULL)
+        u->nivcsw = strtol(p + 27, NULL, 10);
     return 0;
 }
 
-/* listjobs - Print the job list */
-void listjobs(struct job_t *jobs, int output_fd)
+/*
+ * listjobs - Print the job list, with the usage of each job if verbose.
+ *     Returns -1 if output_fd can't be written.
+ */
+int listjobs(job_list jobs, int output_fd, int verbose)
 {
     int i;
     char buf[MAXLINE];
+    struct job_t *job;
+    struct job_usage u;
+    struct timespec now;
 
-    for (i = 0; i < MAXJOBS; i++) {
-        memset(buf, '\0', MAXLINE);
-        if (jobs[i].pid != 0) {
-            sprintf(buf, "[%d] (%d) ", jobs[i].jid, jobs[i].pid);
-            if (write(output_fd, buf, strlen(buf)) < 0) {
-                fprintf(stderr, "Error writing to output file\n");
-                exit(1);
-            }
-            memset(buf, '\0', MAXLINE);
-            switch (jobs[i].state) {
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (i = 1; i <= jobs->max_jid; i++) {
+        if ((job = jobs->by_jid[i]) != NULL) {
+            switch (job->state) {
                 case BG:
-                    sprintf(buf, "Running    ");
+                    sprintf(buf, "[%d] (%d) Running    ", job->jid, job->pid);
                     break;
                 case FG:
-                    sprintf(buf, "Foreground ");
+                    sprintf(buf, "[%d] (%d) Foreground ", job->jid, job->pid);
                     break;
                 case ST:
-                    sprintf(buf, "Stopped    ");
+                    sprintf(buf, "[%d] (%d) Stopped    ", job->jid, job->pid);
                     break;
                 default:
-                    sprintf(buf, "listjobs: Internal error: job[%d].state=%d\n",
-                            i, jobs[i].state);
+                    sprintf(buf, "[%d] (%d) listjobs: Internal error: job[%d].state=%d\n",
+                            job->jid, job->pid, i, job->state);
             }
-            if (write(output_fd, buf, strlen(buf)) < 0) {
-                fprintf(stderr, "Error writing to output file\n");
-                exit(1);
-            }
-            memset(buf, '\0', MAXLINE);
-            sprintf(buf, "%s", jobs[i].cmdline);
-            if (write(output_fd, buf, strlen(buf)) < 0) {
-                fprintf(stderr, "Error writing to output file\n");
-                exit(1);
+            /* the command line has no length limit, write it as it is */
+            if (write(output_fd, buf, strlen(buf)) < 0 ||
+                write(output_fd, job->cmdline, strlen(job->cmdline)) < 0)
+                return -1;
+            if (verbose) {
+                u = job->usage;
+                read_proc_usage(job->pid, &u);
+                sprintf(buf, "    elapsed %.3fs user %ld.%03lds sys %ld.%03lds maxrss %ldKB csw %ld/%ld\n",
+                        ts_sub_ms(now, u.start) / 1000.0,
+                        (long) u.utime.tv_sec, (long) u.utime.tv_usec / 1000,
+                        (long) u.stime.tv_sec, (long) u.stime.tv_usec / 1000,
+                        u.maxrss, u.nvcsw, u.nivcsw);
+                if (write(output_fd, buf, strlen(buf)) < 0)
+                    return -1;
             }
         }
     }
-    if (output_fd != STDOUT_FILENO)
-        close(output_fd);
+    return 0;
+}
+
+/* print_usage - Print a job's usage like the time builtin of bash */
+void print_usage(int output_fd, const struct job_usage *usage)
+{
+    long real = ts_sub_ms(usage->end, usage->start);
+    long user = usage->utime.tv_sec * 1000L + usage->utime.tv_usec / 1000;
+    long sys = usage->stime.tv_sec * 1000L + usage->stime.tv_usec / 1000;
+    fflush(stdout);
+    dprintf(output_fd, "real\t%ldm%ld.%03lds\nuser\t%ldm%ld.%03lds\nsys\t%ldm%ld.%03lds\n"
+                       "maxrss\t%ldKB\ncsw\t%ld voluntary, %ld involuntary\n",
+            real / 60000, real / 1000 % 60, real % 1000,
+            user / 60000, user / 1000 % 60, user % 1000,
+            sys / 60000, sys / 1000 % 60, sys % 1000,
+            usage->maxrss, usage->nvcsw, usage->nivcsw);
+}
+
+/* tv_sub_us - Returns a - b in microseconds */
+static long tv_sub_us(struct timeval a, struct timeval b)
+{
+    return (a.tv_sec - b.tv_sec) * 1000000L + (a.tv_usec - b.tv_usec);
 }
 
 /*
  * waitfg - Block until process pid is no longer the foreground process
+ *
+ * The shell sleeps in the reactor, which reaps the job (or stops it, on
+ * ctrl-z) when its signal or pidfd says so; it burns no CPU while waiting.
  */
 void waitfg(pid_t pid, int output_fd)
 {
+    struct rusage before, after;
+    char buf[MAXLINE];
+
+    if (waitfg_report)
+        getrusage(RUSAGE_SELF, &before);
+
     while (pid == fgpid(jobs))
-        sleep(0);
+        run_reactor(-1, -1);
+
+    if (waitfg_report) {
+        getrusage(RUSAGE_SELF, &after);
+        sprintf(buf, "waitfg: (%d) shell cpu user %ldus sys %ldus\n", pid,
+                tv_sub_us(after.ru_utime, before.ru_utime),
+                tv_sub_us(after.ru_stime, before.ru_stime));
+        fflush(stdout);
+        if (write(output_fd, buf, strlen(buf)) < 0) {
+            fprintf(stderr, "Error writing to output file\n");
+            exit(1);
+        }
+    }
+}
+
+/*
+ * wait_jobs - Execute the builtin wait command: wait for the given jobs
+ *     (PID or %jobid) to exit, or for every background job if none.
+ *     Stopped jobs aren't waited for.
+ */
+void wait_jobs(char **argv)
+{
+    struct job_t *job;
+    char *id;
+    pid_t pid;
+
+    if (argv[1] == NULL) {
+        while (jobs->running_bg > 0)
+            run_reactor(-1, -1);
+        return;
+    }
+    for (int i = 1; (id = argv[i]) != NULL; i++) {
+        if (id[0] == '%')
+            job = getjobjid(jobs, atoi(id + 1));
+        else
+            job = getjobpid(jobs, atoi(id));
+        if (job == NULL) {
+            printf("wait: %s: No such job\n", id);
+            continue;
+        }
+        /* the record is recycled once the job is gone */
+        pid = job->pid;
+        while ((job = getjobpid(jobs, pid)) != NULL && job->state == BG)
+            run_reactor(-1, -1);
+    }
 }
 
 /*
@@ -216,9 +736,9 @@ void do_bgfg(char **argv, int output_fd)
     /* handle bg/fg */
     if (!strcmp("bg", cmd)) {
         printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
-        job->state = BG;
+        setjobstate(jobs, job, BG);
     } else if (!strcmp("fg", cmd)) {
-        job->state = FG;
+        setjobstate(jobs, job, FG);
         waitfg(job->pid, STDOUT_FILENO);
     } else {
         printf("bg/fg error: %s\n", cmd);
@@ -1,8 +1,12 @@
 #ifndef OS_HW_JOB_H
 #define OS_HW_JOB_H
 
-#define MAXJOBS      16   /* max jobs at any point in time */
-#define MAXLINE    1024   /* max line size */
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define MAXLINE    1024   /* size of the fixed line buffers */
 
 /*
  * Jobs states: FG (foreground), BG (background), ST (stopped)
@@ -18,6 +22,29 @@
 #define BG 2    /* running in background */
 #define ST 3    /* stopped */
 
+/* Resource usage of a job, from wait4 once it's reaped */
+struct job_usage
+{
+    struct timespec start;  /* wall clock (monotonic) when it was started */
+    struct timespec end;    /* and when it was reaped */
+    struct timeval utime;   /* user cpu time */
+    struct timeval stime;   /* system cpu time */
+    long maxrss;            /* max resident set size, KB */
+    long nvcsw;             /* voluntary context switches */
+    long nivcsw;            /* involuntary context switches */
+};
+
+/* A process of a job: the command, or one stage of a pipeline */
+struct job_stage
+{
+    pid_t pid;              /* 0 if it couldn't be started */
+    int pidfd;              /* watched by the reactor, -1 if not */
+    int running;            /* not reaped yet */
+    int status;             /* wait status, once reaped */
+    int watch_fd;           /* read end of the pipe into it, for pipesz, -1 if none */
+    int full;               /* samples in a row that pipe was full */
+};
+
 struct job_t
 {
     /* The job struct */
@@ -27,28 +54,69 @@ struct job_t
     /* job ID [1, 2, ...] */
     int state;
     /* UNDEF, BG, FG, or ST */
-    char cmdline[MAXLINE];  /* command line */
+    char *cmdline;          /* command line */
+    size_t cmdline_cap;     /* size of the cmdline buffer */
+    struct job_usage usage; /* resources used, filled in by finishjob */
+    struct job_stage *stages;   /* its processes, in pipeline order */
+    int nstages;
+    int stages_cap;
+    int running;            /* stages not reaped yet */
+    struct job_t *next_free;  /* link in the list of recycled records */
 };
 
+struct job_list_record;
+
+typedef struct job_list_record *job_list;
+
 /* The job list */
-struct job_t jobs[MAXJOBS];
+extern job_list jobs;
+
+/* report shell CPU time spent in waitfg */
+extern int waitfg_report;
+
+void initjobs(job_list jobs);
+
+int addjob(job_list jobs, pid_t pid, int state, const char *cmdline);
 
-void initjobs(struct job_t *jobs);
+int addpipeline(job_list jobs, const pid_t *pids, const int *watch_fds, int n,
+                int state, const char *cmdline);
 
-int addjob(struct job_t *jobs, pid_t pid, int state, const char *cmdline);
+int addstage(job_list jobs, pid_t job_pid, pid_t pid);
 
-int deletejob(struct job_t *jobs, pid_t pid);
+int deletejob(job_list jobs, pid_t pid);
 
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
+int finishjob(job_list jobs, pid_t pid, int status, const struct rusage *ru);
+
+int watching_pipes(job_list jobs);
+
+void grow_job_pipes(job_list jobs);
+
+void setfgstatus(int status);
+
+int print_pipestatus(int output_fd);
+
+int stagestatus(job_list jobs, pid_t job_pid, int i, int *status);
+
+int getfgusage(pid_t pid, struct job_usage *usage);
+
+void print_usage(int output_fd, const struct job_usage *usage);
+
+struct job_t *getjobpid(job_list jobs, pid_t pid);
+
+struct job_t *getjobjid(job_list jobs, int jid);
+
+void setjobstate(job_list jobs, struct job_t *job, int state);
 
 int pid2jid(pid_t pid);
 
-pid_t fgpid(struct job_t *jobs);
+pid_t fgpid(job_list jobs);
 
-void listjobs(struct job_t *jobs, int output_fd);
+int listjobs(job_list jobs, int output_fd, int verbose);
 
 void do_bgfg(char **argv, int output_fd);
 
 void waitfg(pid_t pid, int output_fd);
 
+void wait_jobs(char **argv);
+
 #endif //OS_HW_JOB_H
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#include "lineedit.h"
+#include "complete.h"
+#include "history.h"
+#include "reactor.h"
+#include "errmsg.h"
+
+#define INIT_LINE 256   /* line buffer before it has to grow */
+
+/*
+ * A line editor for a terminal: the terminal is in raw mode only while a
+ * line is read, so the commands run get it as they'd expect.
+ *
+ *   ^A/^E home/end     ^B/^F, arrows   move     ^P/^N, up/down  history
+ *   ^H/DEL, ^D         delete          ^U/^K    kill to start/end
+ *   ^W                 delete a word   ^L       clear the screen
+ *   ^C                 drop the line   ^D       on an empty line, EOF
+ *   TAB                complete; a second TAB lists the choices
+ */
+static char *buf;           /* the line, '\n' and NUL added on return */
+static size_t len;
+static size_t cap;
+static size_t pos;          /* the cursor */
+static const char *cur_prompt;
+static arena complete_arena;
+
+/* reserve - Make room for n more characters, and the '\n' and NUL */
+static void reserve(size_t n)
+{
+    if (len + n + 2 <= cap)
+        return;
+    while (len + n + 2 > cap)
+        cap = cap > 0 ? cap * 2 : INIT_LINE;
+    if ((buf = realloc(buf, cap)) == NULL)
+        app_error("out of space!!");
+}
+
+/* put - Write s to the terminal */
+static void put(const char *s, size_t n)
+{
+    ssize_t w;
+    while (n > 0 && ((w = write(STDOUT_FILENO, s, n)) > 0 || errno == EINTR)) {
+        if (w > 0) {
+            s += w;
+            n -= w;
+        }
+    }
+}
+
+/* refresh - Redraw the prompt and the line, and put the cursor back */
+static void refresh(void)
+{
+    char move[32];
+    size_t plen = strlen(cur_prompt);
+    put("\r", 1);
+    put(cur_prompt, plen);
+    put(buf, len);
+    put("\x1b[K\r", 4);
+    if (plen + pos > 0)
+        put(move, sprintf(move, "\x1b[%zuC", plen + pos));
+}
+
+/* replace - Replace buf[start..end) with s */
+static void replace(size_t start, size_t end, const char *s, size_t n)
+{
+    if (n > end - start)
+        reserve(n - (end - start));
+    memmove(buf + start + n, buf + end, len - end);
+    memcpy(buf + start, s, n);
+    len = len - (end - start) + n;
+    pos = start + n;
+}
+
+/* set_line - Make s the whole line, for the history keys */
+static void set_line(const char *s, size_t n)
+{
+    replace(0, len, s, n);
+    refresh();
+}
+
+/* show_matches - List the choices in columns under the line */
+static void show_matches(char **matches, int n)
+{
+    struct winsize ws;
+    int width = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+    size_t col = 0;
+    int cols, rows;
+    const char *name;
+
+    /* show the last part of a path, unescaped and without the ' ' */
+    for (int i = 0; i < n; i++) {
+        char *d = matches[i], *p;
+        name = matches[i];
+        for (p = matches[i]; p[0] != '\0' && p[1] != '\0'; p++) {
+            if (p[0] == '/')
+                name = p + 1;
+            else if (p[0] == '\\')
+                p++;
+        }
+        for (p = (char *) name; *p != '\0'; p++) {
+            if (*p == '\\' && p[1] != '\0')
+                p++;
+            *d++ = *p;
+        }
+        if (d > matches[i] && d[-1] == ' ')
+            d--;
+        *d = '\0';
+        if (strlen(matches[i]) > col)
+            col = strlen(matches[i]);
+    }
+    col += 2;
+    cols = (int) (width / col) > 0 ? (int) (width / col) : 1;
+    rows = (n + cols - 1) / cols;
+    put("\r\n", 2);
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols && c * rows + r < n; c++) {
+            name = matches[c * rows + r];
+            put(name, strlen(name));
+            for (size_t k = strlen(name); k < col && c + 1 < cols && (c + 1) * rows + r < n; k++)
+                put(" ", 1);
+        }
+        put("\r\n", 2);
+    }
+}
+
+/* complete - Complete the word before the cursor */
+static void complete(int listed)
+{
+    char **matches;
+    size_t start, common;
+    int n;
+
+    if (complete_arena == NULL)
+        complete_arena = create_arena(0);
+    buf[len] = '\0';
+    n = complete_line(buf, pos, &start, &matches, complete_arena);
+    if (n == 0) {
+        put("\a", 1);
+    } else if (n == 1) {
+        replace(start, pos, matches[0], strlen(matches[0]));
+    } else {
+        /* as far as the choices agree */
+        common = strlen(matches[0]);
+        for (int i = 1; i < n; i++) {
+            size_t k = 0;
+            while (k < common && matches[i][k] == matches[0][k])
+                k++;
+            common = k;
+        }
+        if (common > pos - start) {
+            replace(start, pos, matches[0], common);
+        } else if (listed) {
+            show_matches(matches, n);
+        } else {
+            put("\a", 1);
+        }
+    }
+    refresh();
+    clear_arena(complete_arena);
+}
+
+/* clear - Clear the line, for a job notice to be printed over it */
+static void clear(void)
+{
+    put("\r\x1b[K", 4);
+}
+
+/*
+ * read_key - Returns the next byte from the terminal, -1 at EOF. Jobs
+ *     that end while it waits are reported above the line.
+ */
+static int read_key(void)
+{
+    unsigned char c;
+    ssize_t n;
+    while (wait_input(STDIN_FILENO, clear))
+        refresh();
+    while ((n = read(STDIN_FILENO, &c, 1)) < 0 && errno == EINTR)
+        ;
+    return n == 1 ? c : -1;
+}
+
+/*
+ * edit_line - Read a line from the terminal with editing, history and
+ *     completion. Returns it with its '\n', good until the next call, or
+ *     NULL at EOF.
+ */
+char *edit_line(const char *prompt)
+{
+    struct termios saved, raw;
+    char *saved_line = NULL;   /* the new line, while browsing history */
+    size_t saved_len = 0;
+    long hist = history_count();
+    const char *s;
+    size_t n;
+    int c, last = 0;
+    char *result = NULL;
+
+    if (tcgetattr(STDIN_FILENO, &saved) < 0)
+        return NULL;
+    raw = saved;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+    cur_prompt = prompt;
+    len = pos = 0;
+    reserve(0);
+    refresh();
+    while (result == NULL && (c = read_key()) >= 0) {
+        if (c == '\x1b') {      /* ESC [ x, ESC O x, ESC [ n ~ */
+            int c1 = read_key(), c2 = read_key();
+            if (c1 == '[' && c2 >= '0' && c2 <= '9') {
+                if (read_key() == '~' && c2 == '3')
+                    c = CTRL('D') | 0x100;  /* delete, never EOF */
+                else
+                    continue;
+            } else if (c1 == '[' || c1 == 'O') {
+                switch (c2) {
+                    case 'A': c = CTRL('P'); break;
+                    case 'B': c = CTRL('N'); break;
+                    case 'C': c = CTRL('F'); break;
+                    case 'D': c = CTRL('B'); break;
+                    case 'H': c = CTRL('A'); break;
+                    case 'F': c = CTRL('E'); break;
+                    default: continue;
+                }
+            } else {
+                continue;
+            }
+        }
+        switch (c) {
+            case '\r':
+            case '\n':
+                put("\r\n", 2);
+                buf[len++] = '\n';
+                buf[len] = '\0';
+                result = buf;
+                break;
+            case '\t':
+                complete(last == '\t');
+                break;
+            case CTRL('C'):
+                put("^C\r\n", 4);
+                len = pos = 0;
+                refresh();
+                break;
+            case CTRL('D'):
+                if (len == 0)
+                    goto eof;
+                /* fall through */
+            case CTRL('D') | 0x100:
+                if (pos < len) {
+                    replace(pos, pos + 1, "", 0);
+                    refresh();
+                }
+                break;
+            case CTRL('H'):
+            case 127:
+                if (pos > 0) {
+                    replace(pos - 1, pos, "", 0);
+                    refresh();
+                }
+                break;
+            case CTRL('A'):
+                pos = 0;
+                refresh();
+                break;
+            case CTRL('E'):
+                pos = len;
+                refresh();
+                break;
+            case CTRL('B'):
+                if (pos > 0)
+                    pos--;
+                refresh();
+                break;
+            case CTRL('F'):
+                if (pos < len)
+                    pos++;
+                refresh();
+                break;
+            case CTRL('U'):
+                replace(0, pos, "", 0);
+                refresh();
+                break;
+            case CTRL('K'):
+                len = pos;
+                refresh();
+                break;
+            case CTRL('W'):
+                n = pos;
+                while (n > 0 && buf[n - 1] == ' ')
+                    n--;
+                while (n > 0 && buf[n - 1] != ' ')
+                    n--;
+                replace(n, pos, "", 0);
+                refresh();
+                break;
+            case CTRL('L'):
+                put("\x1b[H\x1b[2J", 7);
+                refresh();
+                break;
+            case CTRL('P'):
+                if (hist > 0 && (s = history_entry(hist - 1, &n)) != NULL) {
+                    if (hist == history_count()) {  /* keep what was typed */
+                        free(saved_line);
+                        if ((saved_line = malloc(len + 1)) == NULL)
+                            app_error("out of space!!");
+                        memcpy(saved_line, buf, len);
+                        saved_len = len;
+                    }
+                    hist--;
+                    set_line(s, n);
+                }
+                break;
+            case CTRL('N'):
+                if (hist + 1 < history_count() && (s = history_entry(hist + 1, &n)) != NULL) {
+                    hist++;
+                    set_line(s, n);
+                } else if (hist + 1 == history_count()) {
+                    hist++;
+                    set_line(saved_line != NULL ? saved_line : "", saved_len);
+                }
+                break;
+            default:
+                if (c >= ' ' && c < 256) {
+                    char ch = (char) c;
+                    replace(pos, pos, &ch, 1);
+                    if (pos == len)
+                        put(&ch, 1);
+                    else
+                        refresh();
+                }
+        }
+        last = c;
+    }
+eof:
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+    free(saved_line);
+    return result;
+}
@@ -0,0 +1,6 @@
+#ifndef OS_HW_LINEEDIT_H
+#define OS_HW_LINEEDIT_H
+
+char *edit_line(const char *prompt);
+
+#endif //OS_HW_LINEEDIT_H
@@ -1,75 +1,157 @@
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "linked_hash_table.h"
 #include "errmsg.h"
 
-#define HASH_TABLE_SIZE_EXP 8
+#define INIT_SLOTS_EXP 4        /* index slots of a new table, as a power of two */
+#define INLINE_KEY     24       /* keys shorter than this are kept in the entry */
 
-typedef unsigned int index_t;
+/* index slot values besides entry + 1 */
+#define SLOT_EMPTY   0
+#define SLOT_REMOVED UINT32_MAX
 
-struct linked_node_record;
+typedef unsigned int index_t;
 
-typedef struct linked_node_record *linked_node;
+struct ht_entry
+{
+    uint64_t hash;
+    value_t value;              /* NULL once the entry is removed */
+    char *long_key;             /* NULL for a key in inline_key */
+    char inline_key[INLINE_KEY];
+};
 
-struct linked_node_record
+struct ht_slot
 {
-    linked_node next;
-    linked_node dnext;
-    linked_node dprev;
-    hkey_t key;
-    value_t value;
+    uint32_t entry;             /* entry index + 1, or SLOT_EMPTY/SLOT_REMOVED */
+    uint32_t tag;               /* high bits of the hash, checked first */
 };
 
+/*
+ * The entries are kept in a dense array in insertion order, which is
+ * what get_all_linked_ht_data walks, and found through an open-addressing
+ * index of entry numbers with linear probing. The index is kept at most
+ * 3/4 full, counting removed slots, and is rebuilt (bigger if need be)
+ * when it fills; a removed entry stays a hole in the array until then.
+ *
+ * Keys shorter than INLINE_KEY live in their entry, so a lookup usually
+ * touches one slot and one entry. Values are separate mallocs, so a value
+ * returned by get_linked_ht stays put while the table grows.
+ */
 struct linked_ht_record
 {
-    int r;
-    index_t capacity;
-    index_t size;
-    linked_node dheader;
-    linked_node *headers;
+    int r;                      /* log2 of capacity */
+    index_t capacity;           /* index slots */
+    index_t size;               /* live entries */
+    index_t used;               /* entries in the array, holes included */
+    index_t removed;            /* SLOT_REMOVED slots in the index */
+    index_t entries_cap;
+    struct ht_entry *entries;
+    struct ht_slot *slots;
 };
 
-index_t bkdr_hash(hkey_t str, index_t cap)
+/* read64 - 8 bytes of str, in whatever alignment */
+static inline uint64_t read64(const char *str)
+{
+    uint64_t v;
+    memcpy(&v, str, sizeof(v));
+    return v;
+}
+
+/* mix64 - murmur3's finalizer, every input bit reaches every output bit */
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* hash64 - Hash len bytes of str, 8 at a time */
+static uint64_t hash64(const char *str, size_t len)
 {
-    unsigned int seed = 131;
-    unsigned int hash = 0;
-    while (*str) {
-        hash = hash * seed + (*str++);
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ (len * 0xc6a4a7935bd1e995ULL);
+    uint64_t tail = 0;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        h ^= mix64(read64(str + i));
+        h = (h << 27 | h >> 37) * 0x9E3779B97F4A7C15ULL;
     }
-    return (hash & 0x7FFFFFFF) % cap;
+    memcpy(&tail, str + i, len - i);
+    h ^= mix64(tail ^ len);
+    return mix64(h);
 }
 
-linked_ht create_linked_ht()
+static inline char *entry_key(struct ht_entry *e)
 {
-    linked_ht t;
-    if ((t = malloc(sizeof(struct linked_ht_record))) == NULL) {
+    return e->long_key != NULL ? e->long_key : e->inline_key;
+}
+
+/* alloc_slots - Give t an empty index of 2^r slots */
+static int alloc_slots(linked_ht t, int r)
+{
+    struct ht_slot *slots;
+    if ((slots = calloc((size_t) 1 << r, sizeof(struct ht_slot))) == NULL) {
         app_error("out of space!!");
-        return NULL;
+        return -1;
     }
-    t->r = HASH_TABLE_SIZE_EXP;
-    t->capacity = 1U << t->r;
-    t->size = 0;
-    if ((t->dheader = malloc(sizeof(struct linked_node_record))) == NULL) {
+    free(t->slots);
+    t->slots = slots;
+    t->r = r;
+    t->capacity = 1U << r;
+    t->removed = 0;
+    return 0;
+}
+
+/* place - Put entry i in the first free slot of its probe sequence */
+static void place(linked_ht t, index_t i)
+{
+    uint64_t h = t->entries[i].hash;
+    index_t mask = t->capacity - 1;
+    index_t s = (index_t) h & mask;
+    while (t->slots[s].entry != SLOT_EMPTY) {
+        s = (s + 1) & mask;
+    }
+    t->slots[s].entry = i + 1;
+    t->slots[s].tag = (uint32_t) (h >> 32);
+}
+
+/*
+ * rebuild - Compact the entries, closing the holes removals left, and
+ *     index them again in 2^r slots.
+ */
+static int rebuild(linked_ht t, int r)
+{
+    index_t n = 0;
+    if (alloc_slots(t, r) < 0) {
+        return -1;
+    }
+    for (index_t i = 0; i < t->used; i++) {
+        if (t->entries[i].value == NULL) {
+            continue;
+        }
+        if (n != i) {
+            t->entries[n] = t->entries[i];
+        }
+        place(t, n++);
+    }
+    t->used = n;
+    return 0;
+}
+
+linked_ht create_linked_ht()
+{
+    linked_ht t;
+    if ((t = calloc(1, sizeof(struct linked_ht_record))) == NULL) {
         app_error("out of space!!");
-        free(t);
         return NULL;
     }
-    t->dheader->dnext = NULL;
-    t->dheader->dprev = NULL;
-    if ((t->headers = malloc(sizeof(linked_node) * t->capacity)) == NULL) {
-        app_error("out of space!!");
+    if (alloc_slots(t, INIT_SLOTS_EXP) < 0) {
         free(t);
-        free(t->dheader);
         return NULL;
     }
-    for (index_t i = 0; i < t->capacity; i++) {
-        if ((t->headers[i] = malloc(sizeof(struct linked_node_record))) == NULL) {
-            t->capacity = i;
-            app_error("out of space!!");
-            break;
-        }
-        t->headers[i]->next = NULL;
-    }
     return t;
 }
 
@@ -85,127 +167,140 @@ int size_linked_ht(linked_ht t)
 
 void clear_linked_ht(linked_ht t)
 {
-    for (index_t i = 0; i < t->capacity; i++) {
-        while (t->headers[i]->next != NULL) {
-            linked_node n = t->headers[i]->next;
-            t->headers[i]->next = n->next;
-            free(n->value);
-            free(n->key);
-            free(n);
+    for (index_t i = 0; i < t->used; i++) {
+        if (t->entries[i].value != NULL) {
+            free(t->entries[i].value);
+            free(t->entries[i].long_key);
         }
     }
+    memset(t->slots, 0, t->capacity * sizeof(struct ht_slot));
     t->size = 0;
+    t->used = 0;
+    t->removed = 0;
 }
 
 void dispose_linked_ht(linked_ht t)
 {
     clear_linked_ht(t);
-    for (index_t i = 0; i < t->capacity; i++) {
-        free(t->headers[i]);
-    }
-    free(t->headers);
-    free(t->dheader);
+    free(t->entries);
+    free(t->slots);
     free(t);
 }
 
-void insert_dnext(linked_node a, linked_node b)
+/* find_slot - Returns the slot holding key k, or -1 */
+static long find_slot(linked_ht t, hkey_t k, uint64_t h)
 {
-    if (a && b) {
-        b->dnext = a->dnext;
-        if (a->dnext) {
-            a->dnext->dprev = b;
+    index_t mask = t->capacity - 1;
+    index_t s = (index_t) h & mask;
+    uint32_t tag = (uint32_t) (h >> 32);
+    struct ht_entry *e;
+    for (; t->slots[s].entry != SLOT_EMPTY; s = (s + 1) & mask) {
+        if (t->slots[s].entry == SLOT_REMOVED || t->slots[s].tag != tag) {
+            continue;
+        }
+        e = &t->entries[t->slots[s].entry - 1];
+        if (e->hash == h && strcmp(entry_key(e), k) == 0) {
+            return s;
         }
-        a->dnext = b;
-        b->dprev = a;
     }
+    return -1;
 }
 
 int put_linked_ht(linked_ht t, hkey_t k, value_t v)
 {
-    index_t i = bkdr_hash(k, t->capacity);
-    linked_node p = t->headers[i];
-    linked_node node;
-    while (p->next != NULL && strcmp(p->next->key, k) != 0) {
-        p = p->next;
+    size_t len = strlen(k);
+    uint64_t h = hash64(k, len);
+    long s = find_slot(t, k, h);
+    struct ht_entry *e;
+    value_t value;
+
+    if ((value = strdup(v)) == NULL) {
+        app_error("out of space!!");
+        return -1;
     }
-    if (p->next == NULL) {
-        if ((node = malloc(sizeof(struct linked_node_record))) == NULL) {
-            app_error("out of space!!");
-            return -1;
-        }
-        if ((node->key = malloc(strlen(k) + 1)) == NULL) {
-            app_error("out of space!!");
-            return -1;
+    if (s >= 0) {
+        e = &t->entries[t->slots[s].entry - 1];
+        free(e->value);
+        e->value = value;
+        return 0;
+    }
+    /* keep the index at most 3/4 full, holes and removed slots included */
+    if (4 * (t->size + t->removed + 1) > 3 * t->capacity) {
+        int r = t->r;
+        while (4 * (t->size + 1) > 3 * (1U << r) / 2) {
+            r++;
         }
-        strcpy(node->key, k);
-        if ((node->value = malloc(strlen(v) + 1)) == NULL) {
-            app_error("out of space!!");
+        if (rebuild(t, r) < 0) {
+            free(value);
             return -1;
         }
-        strcpy(node->value, v);
-        node->next = NULL;
-        p->next = node;
-        insert_dnext(t->dheader, node);
-        t->size++;
-    } else {
-        free(p->next->value);
-        if ((p->next->value = malloc(strlen(v) + 1)) == NULL) {
+    }
+    if (t->used == t->entries_cap) {
+        index_t cap = t->entries_cap > 0 ? 2 * t->entries_cap : 8;
+        struct ht_entry *entries;
+        if ((entries = realloc(t->entries, cap * sizeof(struct ht_entry))) == NULL) {
             app_error("out of space!!");
+            free(value);
             return -1;
         }
-        strcpy(p->next->value, v);
+        t->entries = entries;
+        t->entries_cap = cap;
     }
-    return 0;
-}
-
-linked_node search_linked_ht(linked_ht t, hkey_t k)
-{
-    index_t i = bkdr_hash(k, t->capacity);
-    linked_node p = t->headers[i];
-    while (p->next != NULL && strcmp(p->next->key, k) != 0) {
-        p = p->next;
+    e = &t->entries[t->used];
+    e->hash = h;
+    e->value = value;
+    e->long_key = NULL;
+    if (len < INLINE_KEY) {
+        memcpy(e->inline_key, k, len + 1);
+    } else if ((e->long_key = strdup(k)) == NULL) {
+        app_error("out of space!!");
+        free(value);
+        return -1;
     }
-    return p->next;
+    place(t, t->used++);
+    t->size++;
+    return 0;
 }
 
 value_t get_linked_ht(linked_ht t, hkey_t k)
 {
-    linked_node result = search_linked_ht(t, k);
-    return result == NULL ? NULL : result->value;
+    size_t len = strlen(k);
+    long s = find_slot(t, k, hash64(k, len));
+    return s < 0 ? NULL : t->entries[t->slots[s].entry - 1].value;
 }
 
 int remove_linked_ht(linked_ht t, hkey_t k)
 {
-    index_t i = bkdr_hash(k, t->capacity);
-    linked_node p = t->headers[i];
-    while (p->next != NULL && strcmp(p->next->key, k) != 0) {
-        p = p->next;
-    }
-    if (p->next != NULL) {
-        linked_node n = p->next;
-        p->next = n->next;
-        n->dprev->dnext = n->dnext;
-        n->dnext->dprev = n->dprev;
-        free(n->value);
-        free(n->key);
-        free(n);
-        t->size--;
-        return 0;
-    } else {
+    size_t len = strlen(k);
+    long s = find_slot(t, k, hash64(k, len));
+    struct ht_entry *e;
+    if (s < 0) {
         return -1;
     }
+    e = &t->entries[t->slots[s].entry - 1];
+    free(e->value);
+    free(e->long_key);
+    e->value = NULL;
+    e->long_key = NULL;
+    t->slots[s].entry = SLOT_REMOVED;
+    t->removed++;
+    t->size--;
+    return 0;
 }
 
+/*
+ * get_all_linked_ht_data - Fill keys and values with up to size entries,
+ *     the most recently added first, as the linked version listed them.
+ */
 void get_all_linked_ht_data(linked_ht t, hkey_t *keys, value_t *values, int size)
 {
-    linked_node n = t->dheader->dnext;
-
-    for (int i = 0; i < size; i++) {
-        if (n == NULL) {
-            break;
+    int n = 0;
+    for (index_t i = t->used; i > 0 && n < size; i--) {
+        struct ht_entry *e = &t->entries[i - 1];
+        if (e->value == NULL) {
+            continue;
         }
-        keys[i] = n->key;
-        values[i] = n->value;
-        n = n->dnext;
+        keys[n] = entry_key(e);
+        values[n++] = e->value;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+
+#include "parallel.h"
+#include "sigutil.h"
+#include "reactor.h"
+#include "errmsg.h"
+#include "exec.h"
+#include "trace.h"
+#include "job.h"
+
+#define PAR_WINDOW 4    /* lines held for ordered output, per running line */
+
+/* A script line started by start_parallel, in script order */
+struct par_line
+{
+    pid_t pid;      /* 0 once reaped, or for a blank line */
+    int fd;         /* memfd collecting the output, -1 if none */
+    char *echo;     /* the line to echo before its output, or NULL */
+    int timed;      /* time <line>: print its usage after its output */
+    struct timespec start;
+};
+
+/*
+ * The window is a ring of the lines started but not yet printed. At most
+ * max_running of them are running; a line that is done waits for the
+ * lines before it, so the output comes out in script order.
+ */
+static struct par_line *window;
+static int window_cap;
+static int head;            /* oldest line */
+static int count;           /* lines in the window */
+static int running;
+static int max_running;
+static int echo_lines;
+static int failures;        /* lines that exited non-zero or were killed */
+static int interrupted;     /* ctrl-c: start no more lines */
+
+void init_parallel(int max_jobs, int echo)
+{
+    max_running = max_jobs;
+    echo_lines = echo;
+    window_cap = PAR_WINDOW * max_jobs;
+    if ((window = calloc(window_cap, sizeof(struct par_line))) == NULL)
+        app_error("out of space!!");
+}
+
+/*
+ * copy_output - Copy a line's output to stdout, with sendfile when stdout
+ *     takes it (pipes, ttys) and read/write otherwise (e.g. O_APPEND files).
+ */
+static void copy_output(int fd)
+{
+    char buf[BUFSIZ];
+    struct stat st;
+    off_t off = 0;
+    ssize_t n;
+    if (fstat(fd, &st) < 0)
+        return;
+    while (off < st.st_size && (n = sendfile(STDOUT_FILENO, fd, &off, st.st_size - off)) > 0)
+        ;
+    while (off < st.st_size && (n = pread(fd, buf, sizeof(buf), off)) > 0) {
+        if (write(STDOUT_FILENO, buf, n) != n)
+            return;
+        off += n;
+    }
+}
+
+/* emit_line - Print the oldest line and its output, and drop it */
+static void emit_line(void)
+{
+    struct par_line *line = &window[head];
+    if (line->echo != NULL) {
+        printf("%s", line->echo);
+        free(line->echo);
+    }
+    fflush(stdout);
+    if (line->fd >= 0) {
+        copy_output(line->fd);
+        close(line->fd);
+    }
+    head = (head + 1) % window_cap;
+    count--;
+}
+
+/* time_line - Add what a timed line used, as wait4 reported it, to its output */
+static void time_line(struct par_line *line, const struct rusage *ru)
+{
+    struct job_usage usage;
+    usage.start = line->start;
+    clock_gettime(CLOCK_MONOTONIC, &usage.end);
+    usage.utime = ru->ru_utime;
+    usage.stime = ru->ru_stime;
+    usage.maxrss = ru->ru_maxrss;
+    usage.nvcsw = ru->ru_nvcsw;
+    usage.nivcsw = ru->ru_nivcsw;
+    print_usage(line->fd, &usage);
+}
+
+/* signal_lines - Send sig to the process group of every running line */
+static void signal_lines(int sig)
+{
+    for (int i = 0, j = head; i < count; i++, j = (j + 1) % window_cap) {
+        if (window[j].pid > 0)
+            send_signal(-window[j].pid, sig);
+    }
+}
+
+/*
+ * wait_line - Reap one child, handing children that aren't lines to
+ *     report_child, or act on a signal that came first. The lines are in
+ *     process groups of their own, so ctrl-c and ctrl-z are passed on to
+ *     them: after ctrl-c no more lines are started, and ctrl-z stops the
+ *     shell along with them until they're all continued.
+ */
+static void wait_line(void)
+{
+    pid_t pid;
+    int status;
+    struct rusage ru;
+    while ((pid = wait4(-1, &status, WNOHANG, &ru)) <= 0) {
+        if (pid < 0 && errno != EINTR)
+            unix_error("wait_line: waitpid error");
+        if (pid < 0)
+            continue;
+        switch (wait_signal()) {
+            case SIGINT:
+                interrupted = 1;
+                signal_lines(SIGINT);
+                return;
+            case SIGTSTP:
+                signal_lines(SIGTSTP);
+                kill(getpid(), SIGSTOP);
+                signal_lines(SIGCONT);
+                return;
+            case SIGQUIT:
+                signal_lines(SIGQUIT);
+                printf("terminating after receipt of SIGQUIT signal\n");
+                exit(1);
+        }
+    }
+    for (int i = 0, j = head; i < count; i++, j = (j + 1) % window_cap) {
+        if (window[j].pid == pid) {
+            window[j].pid = 0;
+            running--;
+            if (status != 0)
+                failures++;
+            if (window[j].timed)
+                time_line(&window[j], &ru);
+            return;
+        }
+    }
+    report_child(pid, status, &ru);
+}
+
+/*
+ * start_parallel - Start a script line with its output going to a memfd,
+ *     once there is a free slot. The output is printed, after the line
+ *     itself if lines are echoed, when every line before it is printed.
+ *     A timed line (its 'time' already taken off argv) has its usage
+ *     printed after its output.
+ */
+void start_parallel(int argc, char **argv, const char *cmdline, int timed)
+{
+    struct par_line *line;
+    pid_t pid;
+    int fd = -1;
+    int null_fd;
+    struct timespec start;
+
+    while (count == window_cap || (argc > 0 && running == max_running)) {
+        if (window[head].pid == 0)
+            emit_line();
+        else
+            wait_line();
+    }
+    if (interrupted)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (argc > 0) {
+        if ((fd = memfd_create("tsh-line", MFD_CLOEXEC)) < 0)
+            unix_error("start_parallel: memfd_create failed");
+        fflush(stdout);  /* don't let the child inherit buffered output */
+        if ((pid = trace_fork()) == 0) {   /* Child */
+            reactor_child();
+            if (setpgid(0, 0) < 0)
+                unix_error("start_parallel: setpgid failed");
+            /* lines run at the same time can't share the terminal's input */
+            if ((null_fd = open("/dev/null", O_RDONLY)) >= 0) {
+                dup2(null_fd, STDIN_FILENO);
+                close(null_fd);
+            }
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            _exit(subs_exec(argc, argv) != 0);
+        }
+        if (pid < 0)
+            unix_error("start_parallel: fork failed");
+        setpgid(pid, pid);  /* the child does too, whichever is first */
+        running++;  /* not a job: 'jobs' only lists the script's own */
+    } else {
+        pid = 0;
+    }
+    line = &window[(head + count) % window_cap];
+    line->pid = pid;
+    line->fd = fd;
+    line->echo = NULL;
+    line->timed = timed && pid > 0;
+    line->start = start;
+    if (echo_lines && (line->echo = strdup(cmdline)) == NULL)
+        app_error("out of space!!");
+    count++;
+    while (count > 0 && window[head].pid == 0)
+        emit_line();
+}
+
+/* drain_parallel - Wait for every started line and print what's left */
+void drain_parallel(void)
+{
+    while (count > 0) {
+        if (window[head].pid == 0)
+            emit_line();
+        else
+            wait_line();
+    }
+    fflush(stdout);
+}
+
+/* parallel_interrupted - Returns true once ctrl-c has stopped the run */
+int parallel_interrupted(void)
+{
+    return interrupted;
+}
+
+/* parallel_failures - Returns how many lines failed so far */
+int parallel_failures(void)
+{
+    return failures;
+}
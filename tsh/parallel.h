@@ -0,0 +1,16 @@
+#ifndef OS_HW_PARALLEL_H
+#define OS_HW_PARALLEL_H
+
+#define PAR_MAX_STATUS 125  /* exit status cap for the count of failed lines */
+
+void init_parallel(int max_jobs, int echo);
+
+void start_parallel(int argc, char **argv, const char *cmdline, int timed);
+
+void drain_parallel(void);
+
+int parallel_interrupted(void);
+
+int parallel_failures(void);
+
+#endif //OS_HW_PARALLEL_H
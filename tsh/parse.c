@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "parse.h"
+
+/* Operator tokens */
+const char TOK_IN[] = "<";
+const char TOK_OUT[] = ">";
+const char TOK_SUBS_IN[] = "<(";
+const char TOK_SUBS_OUT[] = ">(";
+const char TOK_PIPE[] = "|";
+const char TOK_RIGHT[] = ")";
+const char TOK_BG[] = "&";
+
+/* Character classes of the lexer */
+#define C_WORD    0     /* part of a word */
+#define C_END     1     /* end of the line */
+#define C_SPACE   2     /* separates words */
+#define C_OP      3     /* a one character operator, ends a word */
+#define C_SQUOTE  4     /* '...', taken literally */
+#define C_DQUOTE  5     /* "...", only \" \\ \$ \` are escapes */
+#define C_ESCAPE  6     /* \c, c taken literally */
+
+#define INIT_ARGS 32    /* argv slots before it has to grow */
+
+static const unsigned char char_class[256] = {
+    ['\0'] = C_END, ['\n'] = C_END,
+    [' '] = C_SPACE, ['\t'] = C_SPACE, ['\r'] = C_SPACE,
+    ['<'] = C_OP, ['>'] = C_OP, ['|'] = C_OP, [')'] = C_OP, ['&'] = C_OP,
+    ['\''] = C_SQUOTE, ['"'] = C_DQUOTE, ['\\'] = C_ESCAPE,
+};
+
+/* lex_op - Returns the operator token at p and advances p past it */
+static char *lex_op(const char **p)
+{
+    char c = *(*p)++;
+    switch (c) {
+        case '<':
+        case '>':
+            if (**p == '(') {
+                (*p)++;
+                return (char *) (c == '<' ? TOK_SUBS_IN : TOK_SUBS_OUT);
+            }
+            return (char *) (c == '<' ? TOK_IN : TOK_OUT);
+        case '|':
+            return (char *) TOK_PIPE;
+        case ')':
+            return (char *) TOK_RIGHT;
+        default:
+            return (char *) TOK_BG;
+    }
+}
+
+/*
+ * lex_word - Copy the word at p into out, removing quotes and escapes.
+ *     An unterminated quote ends with the line. Returns the end of out.
+ */
+static char *lex_word(const char **p, char *out)
+{
+    const char *s = *p;
+    for (;;) {
+        switch (char_class[(unsigned char) *s]) {
+            case C_WORD:
+                *out++ = *s++;
+                break;
+            case C_SQUOTE:
+                for (s++; char_class[(unsigned char) *s] != C_END && *s != '\''; )
+                    *out++ = *s++;
+                if (*s == '\'')
+                    s++;
+                break;
+            case C_DQUOTE:
+                for (s++; char_class[(unsigned char) *s] != C_END && *s != '"'; ) {
+                    if (*s == '\\' && (s[1] == '"' || s[1] == '\\' || s[1] == '$' || s[1] == '`'))
+                        s++;
+                    *out++ = *s++;
+                }
+                if (*s == '"')
+                    s++;
+                break;
+            case C_ESCAPE:
+                if (char_class[(unsigned char) *++s] != C_END)
+                    *out++ = *s++;
+                break;
+            default:    /* C_END, C_SPACE, C_OP */
+                *p = s;
+                *out++ = '\0';
+                return out;
+        }
+    }
+}
+
+/*
+ * parse_line - Parse the command line and build the argv array.
+ * Return true (1) if the user has requested a BG job, false
+ * if the user has requested a FG job.
+ *
+ * The line is scanned once, driven by the char_class table. Operators
+ * (< > <( >( | ) &) are returned as the TOK_* pointers, so a quoted
+ * operator is just a word; test them with is_op.
+ *
+ * There is no limit on the line length or the number of words: the
+ * words and argv are allocated from arena a and live until it's cleared.
+ */
+int parse_line(const char *cmdline, int *p_argc, char ***p_argv, arena a)
+{
+    char *out;                      /* where the next word is copied */
+    const char *p = cmdline;        /* ptr that traverses command line */
+    char **argv;
+    char **grown;
+    int cap = INIT_ARGS;            /* size of argv */
+    int argc = 0;                   /* number of args */
+    int bg;                         /* background job? */
+
+    /* a word never takes more room than its characters plus the NUL */
+    out = alloc_arena(a, strlen(cmdline) + 1);
+    argv = alloc_arena(a, cap * sizeof(char *));
+    for (;;) {
+        while (char_class[(unsigned char) *p] == C_SPACE)
+            p++;
+        if (char_class[(unsigned char) *p] == C_END)
+            break;
+        if (argc + 1 == cap) {
+            grown = alloc_arena(a, 2 * cap * sizeof(char *));
+            memcpy(grown, argv, argc * sizeof(char *));
+            argv = grown;
+            cap *= 2;
+        }
+        if (char_class[(unsigned char) *p] == C_OP) {
+            argv[argc++] = lex_op(&p);
+        } else {
+            argv[argc++] = out;
+            out = lex_word(&p, out);
+        }
+    }
+    argv[argc] = NULL;
+    /* should the job run in the background? (a blank line is ignored) */
+    if ((bg = (argc == 0 || is_op(argv[argc - 1], TOK_BG))) && argc > 0)
+        argv[--argc] = NULL;
+    *p_argc = argc;
+    *p_argv = argv;
+    return bg;
+}
+
+int parse_pipe(int argc, char **argv, int *cmd_postions)
+{
+    int j = 1;
+    cmd_postions[0] = 0;
+    for (int i = 0; i < argc; i++) {
+        if (is_op(argv[i], TOK_PIPE) && i != 0) {
+            if (i < argc - 1) {
+                cmd_postions[j++] = i + 1;
+            }
+            argv[i] = NULL;
+        }
+    }
+    return j;
+}
+
+/*
+ * parse_redirect - Strip the < and > redirections out of argv and open
+ *     the files. Returns -1 if a file couldn't be opened.
+ */
+int parse_redirect(char **argv, int *input_fd, int *output_fd)
+{
+    int i = 0;
+    int argc = 0;
+    int last = 0;
+    int fd;
+    while (argv[i] != NULL) {
+        if (is_op(argv[i], TOK_OUT)) {
+            last = 1;
+        } else if (is_op(argv[i], TOK_IN)) {
+            last = 2;
+        } else {
+            if (last == 0) {
+                argv[argc++] = argv[i];
+            } else if (last == 1) {
+                if ((fd = open(argv[i], O_CREAT | O_TRUNC | O_RDWR, 0644)) == -1) {
+                    fprintf(stderr, "Fail to create the file!\n");
+                    return -1;
+                } else {
+                    *output_fd = fd;
+                }
+            } else if (last == 2) {
+                if ((fd = open(argv[i], O_RDONLY)) == -1) {
+                    fprintf(stderr, "Fail to open the file!\n");
+                    return -1;
+                } else {
+                    *input_fd = fd;
+                }
+            }
+            last = 0;
+        }
+        i++;
+    }
+    argv[argc] = NULL;
+    return 0;
+}
+
+/* has_pipe - Returns true if the command line is a pipeline */
+int has_pipe(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (is_op(argv[i], TOK_PIPE)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* has_subs - Returns true if the command line has a process substitution */
+int has_subs(int argc, char **argv)
+{
+    for (int i = 0; i < argc; i++) {
+        if (is_op(argv[i], TOK_RIGHT)) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef OS_HW_PARSE_H
+#define OS_HW_PARSE_H
+
+#include "arena.h"
+
+/*
+ * Operator tokens. parse_line stores these exact pointers in argv for
+ * unquoted operators, so a quoted "|" is an ordinary word.
+ */
+extern const char TOK_IN[];         /* < */
+extern const char TOK_OUT[];        /* > */
+extern const char TOK_SUBS_IN[];    /* <( */
+extern const char TOK_SUBS_OUT[];   /* >( */
+extern const char TOK_PIPE[];       /* | */
+extern const char TOK_RIGHT[];      /* ) */
+extern const char TOK_BG[];         /* & */
+
+#define is_op(tok, op) ((const char *) (tok) == (op))
+
+int parse_line(const char *cmdline, int *p_argc, char ***p_argv, arena a);
+
+int parse_pipe(int argc, char **argv, int *cmd_postions);
+
+int parse_redirect(char **argv, int *input_fd, int *output_fd);
+
+int has_pipe(int argc, char **argv);
+
+int has_subs(int argc, char **argv);
+
+#endif //OS_HW_PARSE_H
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pathcache.h"
+#include "linked_hash_table.h"
+
+#define BUFSIZE 4096
+
+/* command name => resolved path, "" for a negative entry */
+static linked_ht cache;
+
+/* the PATH the cache was filled with */
+static char *cached_path;
+
+static const char *default_path = "/bin:/usr/bin";
+
+/* is_executable - Returns true if path is a regular file we can execute */
+static int is_executable(const char *path)
+{
+    struct stat sb;
+    return stat(path, &sb) == 0 && S_ISREG(sb.st_mode) && access(path, X_OK) == 0;
+}
+
+/* check_path_env - Drop the whole cache if PATH changed since it was filled */
+static int check_path_env(void)
+{
+    const char *path = getenv("PATH");
+    if (path == NULL) {
+        path = default_path;
+    }
+    if (cache == NULL && (cache = create_linked_ht()) == NULL) {
+        return -1;
+    }
+    if (cached_path == NULL || strcmp(cached_path, path) != 0) {
+        clear_linked_ht(cache);
+        free(cached_path);
+        cached_path = strdup(path);
+    }
+    return 0;
+}
+
+/* search_path - Scan the PATH directories for name, like execvp does */
+static int search_path(const char *name, char *result)
+{
+    const char *dir = cached_path;
+    const char *end;
+    size_t len;
+    while (dir != NULL) {
+        end = strchr(dir, ':');
+        len = end != NULL ? (size_t) (end - dir) : strlen(dir);
+        if (len == 0) {  /* an empty entry means the current directory */
+            snprintf(result, BUFSIZE, "./%s", name);
+        } else {
+            snprintf(result, BUFSIZE, "%.*s/%s", (int) len, dir, name);
+        }
+        if (is_executable(result)) {
+            return 1;
+        }
+        dir = end != NULL ? end + 1 : NULL;
+    }
+    return 0;
+}
+
+/*
+ * lookup_path - Resolve a command name through the PATH cache.
+ *     Names containing a slash are returned unchanged. A cached path is
+ *     checked to still be executable before it's returned; a miss is
+ *     cached as a negative entry until PATH changes or the cache is cleared.
+ *     Returns NULL if the command can't be found.
+ */
+const char *lookup_path(const char *name)
+{
+    char result[BUFSIZE];
+    char *path;
+
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+    if (check_path_env() < 0) {
+        return NULL;
+    }
+    if ((path = get_linked_ht(cache, (hkey_t) name)) != NULL) {
+        if (path[0] == '\0') {
+            return NULL;
+        }
+        if (is_executable(path)) {
+            return path;
+        }
+        remove_linked_ht(cache, (hkey_t) name);  /* stale, search again */
+    }
+    if (!search_path(name, result)) {
+        result[0] = '\0';
+    }
+    if (put_linked_ht(cache, (hkey_t) name, result) < 0) {
+        return NULL;
+    }
+    path = get_linked_ht(cache, (hkey_t) name);
+    return path[0] != '\0' ? path : NULL;
+}
+
+/* clear_path_cache - Forget every resolved path */
+void clear_path_cache(void)
+{
+    if (cache != NULL) {
+        clear_linked_ht(cache);
+    }
+}
+
+/* list_path_cache - Print the cache, one "name path" pair per line */
+void list_path_cache(int output_fd)
+{
+    if (cache == NULL) {
+        return;
+    }
+    int size = size_linked_ht(cache);
+    char *keys[size];
+    char *values[size];
+    get_all_linked_ht_data(cache, keys, values, size);
+    fflush(stdout);
+    for (int i = 0; i < size; i++) {
+        dprintf(output_fd, "%s\t%s\n", keys[i], values[i][0] ? values[i] : "(not found)");
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef OS_HW_PATHCACHE_H
+#define OS_HW_PATHCACHE_H
+
+const char *lookup_path(const char *name);
+
+void clear_path_cache(void);
+
+void list_path_cache(int output_fd);
+
+#endif //OS_HW_PATHCACHE_H
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "pipesize.h"
+#include "trace.h"
+
+#define PIPE_FULL_TICKS 2           /* samples in a row a pipe must be full */
+#define PIPE_MAX_SIZE   (1 << 20)   /* fallback for /proc/sys/fs/pipe-max-size */
+
+struct pipe_size_conf pipe_size_conf = {PIPESZ_DEFAULT, 0, 0};
+
+/*
+ * parse_pipe_size - Parse "default", "auto" or a size in bytes (with an
+ *     optional K or M suffix) into conf. Returns -1 if arg is invalid.
+ */
+int parse_pipe_size(const char *arg, struct pipe_size_conf *conf)
+{
+    char *end;
+    long size;
+    if (!strcmp(arg, "default")) {
+        conf->mode = PIPESZ_DEFAULT;
+        return 0;
+    }
+    if (!strcmp(arg, "auto")) {
+        conf->mode = PIPESZ_AUTO;
+        return 0;
+    }
+    size = strtol(arg, &end, 10);
+    if (*end == 'K' || *end == 'k') {
+        size <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        size <<= 20;
+        end++;
+    }
+    if (end == arg || *end != '\0' || size <= 0 || size > 1L << 30) {
+        return -1;
+    }
+    conf->mode = PIPESZ_FIXED;
+    conf->size = (int) size;
+    return 0;
+}
+
+/* print_pipe_size - Print the current pipe size setting */
+void print_pipe_size(int output_fd)
+{
+    fflush(stdout);
+    switch (pipe_size_conf.mode) {
+        case PIPESZ_FIXED:
+            dprintf(output_fd, "%d", pipe_size_conf.size);
+            break;
+        case PIPESZ_AUTO:
+            dprintf(output_fd, "auto");
+            break;
+        default:
+            dprintf(output_fd, "default");
+    }
+    dprintf(output_fd, "%s\n", pipe_size_conf.verbose ? " (verbose)" : "");
+}
+
+/* pipe_max_size - The largest size an unprivileged pipe can be set to */
+static int pipe_max_size(void)
+{
+    static int max_size = 0;
+    FILE *fp;
+    if (max_size == 0) {
+        max_size = PIPE_MAX_SIZE;
+        if ((fp = fopen("/proc/sys/fs/pipe-max-size", "r")) != NULL) {
+            if (fscanf(fp, "%d", &max_size) != 1 || max_size <= 0) {
+                max_size = PIPE_MAX_SIZE;
+            }
+            fclose(fp);
+        }
+    }
+    return max_size;
+}
+
+/*
+ * make_pipe - pipe2() with the configured size applied. A size the kernel
+ *     refuses (over the per-user limits) leaves the pipe at its default.
+ */
+int make_pipe(int fds[2], int flags)
+{
+    if (pipe2(fds, flags) < 0) {
+        return -1;
+    }
+    if (pipe_size_conf.mode == PIPESZ_FIXED) {
+        fcntl(fds[0], F_SETPIPE_SZ, pipe_size_conf.size);
+    }
+    return 0;
+}
+
+/* grow_full_pipe - Sample a watched pipe, and double it if it stayed nearly full */
+void grow_full_pipe(int watch_fd, int *full)
+{
+    int used, size;
+    if (ioctl(watch_fd, FIONREAD, &used) < 0 || (size = fcntl(watch_fd, F_GETPIPE_SZ)) < 0) {
+        return;
+    }
+    if (used * 4 < size * 3) {
+        *full = 0;
+    } else if (++*full >= PIPE_FULL_TICKS && size < pipe_max_size()) {
+        fcntl(watch_fd, F_SETPIPE_SZ, size * 2 < pipe_max_size() ? size * 2 : pipe_max_size());
+        *full = 0;
+    }
+}
+
+/* unwatch_pipe - Stop watching pipe k, reporting its final size if verbose */
+void unwatch_pipe(int *watch_fd, int k)
+{
+    if (*watch_fd >= 0) {
+        if (pipe_size_conf.verbose) {
+            fprintf(stderr, "pipesz: pipe %d: %d bytes\n", k + 1, fcntl(*watch_fd, F_GETPIPE_SZ));
+        }
+        close(*watch_fd);
+        *watch_fd = -1;
+    }
+}
+
+/*
+ * wait_pipeline - Wait for the stages of a pipeline and return the OR of
+ *     their exit statuses. pids[i] is the pid of stage i (0 if it didn't
+ *     run as a child). watch_fds[k] is a duplicate of the read end of the
+ *     pipe after stage k (-1 if none); it is closed as soon as stage k + 1
+ *     exits, so a writer still gets SIGPIPE when its reader goes away.
+ *
+ *     In auto mode the watched pipes are sampled every few milliseconds
+ *     and any pipe that keeps filling up, i.e. whose writer keeps
+ *     blocking, is doubled up to /proc/sys/fs/pipe-max-size.
+ */
+int wait_pipeline(pid_t *pids, int cmd_count, int *watch_fds)
+{
+    struct timespec tick = {0, PIPE_TICK_NS};
+    sigset_t chld, prev;
+    int pipe_count = cmd_count - 1;
+    int full[cmd_count];
+    int remaining = 0;
+    int result = 0;
+    int status;
+    struct rusage ru;
+    pid_t pid;
+
+    memset(full, 0, sizeof(full));
+    for (int i = 0; i < cmd_count; i++) {
+        if (pids[i] > 0) {
+            remaining++;
+        }
+    }
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &prev);
+    while (remaining > 0) {
+        while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+            trace_exit(pid, status, &ru);
+            for (int i = 0; i < cmd_count; i++) {
+                if (pids[i] == pid) {
+                    pids[i] = 0;
+                    remaining--;
+                    result |= WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+                    if (i > 0) {
+                        unwatch_pipe(&watch_fds[i - 1], i - 1);
+                    }
+                }
+            }
+        }
+        if (remaining == 0 || (pid < 0 && errno == ECHILD)) {
+            break;
+        }
+        if (sigtimedwait(&chld, NULL, pipe_size_conf.mode == PIPESZ_AUTO ? &tick : NULL) < 0 &&
+            errno == EAGAIN) {
+            for (int k = 0; k < pipe_count; k++) {
+                if (watch_fds[k] >= 0) {
+                    grow_full_pipe(watch_fds[k], &full[k]);
+                }
+            }
+        }
+    }
+    for (int k = 0; k < pipe_count; k++) {
+        unwatch_pipe(&watch_fds[k], k);
+    }
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return result;
+}
@@ -0,0 +1,34 @@
+#ifndef OS_HW_PIPESIZE_H
+#define OS_HW_PIPESIZE_H
+
+#include <sys/types.h>
+
+/* Pipe size modes */
+#define PIPESZ_DEFAULT 0  /* leave the kernel default (64 KB) */
+#define PIPESZ_FIXED   1  /* set every pipe to pipe_size */
+#define PIPESZ_AUTO    2  /* grow pipelines' pipes while they keep filling up */
+
+#define PIPE_TICK_NS 10000000   /* how often auto mode samples the pipes */
+
+struct pipe_size_conf
+{
+    int mode;
+    int size;       /* bytes, for PIPESZ_FIXED */
+    int verbose;    /* report each pipeline's pipe sizes */
+};
+
+extern struct pipe_size_conf pipe_size_conf;
+
+int parse_pipe_size(const char *arg, struct pipe_size_conf *conf);
+
+void print_pipe_size(int output_fd);
+
+int make_pipe(int fds[2], int flags);
+
+void grow_full_pipe(int watch_fd, int *full);
+
+void unwatch_pipe(int *watch_fd, int k);
+
+int wait_pipeline(pid_t *pids, int cmd_count, int *pipefds);
+
+#endif //OS_HW_PIPESIZE_H
@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "reactor.h"
+#include "sigutil.h"
+#include "errmsg.h"
+#include "trace.h"
+#include "pipesize.h"
+
+#define MAX_EVENTS 64       /* events taken per epoll_wait */
+
+/* epoll data besides a job's pids */
+#define EV_SIGNAL 0
+#define EV_INPUT  1
+#define EV_TICK   2
+
+/*
+ * The shell's event loop. SIGCHLD, SIGINT, SIGTSTP and SIGQUIT are blocked
+ * for good and read from a signalfd; every process of a job has a pidfd;
+ * both are in one epoll set, with the shell's input while it waits for
+ * some, and a timerfd that ticks while pipesz auto watches a pipeline. So
+ * children are reaped, and the job list changed, only in run_reactor,
+ * called where the shell waits: for a foreground job, for input, between
+ * script lines and in the wait builtin. Nothing runs in a signal handler.
+ *
+ * SIGCHLD is enough to find every child that changed state, as wait4 is
+ * called until it has no more; the pidfds make sure a job's exit is seen
+ * even when its SIGCHLD was taken by something else waiting for
+ * children of its own (xargs, pipesz), as a signal pending twice is only
+ * delivered once.
+ */
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static int tick_fd = -1;
+static int ticking;             /* tick_fd is armed */
+static int input_watched = -1;  /* the input fd in the set */
+static int input_polls;         /* and whether it can be polled */
+static void (*notice_hook)(void);
+
+/* init_reactor - Block the job signals, and watch them through a signalfd */
+void init_reactor(void)
+{
+    struct epoll_event ev = {EPOLLIN, {.u64 = EV_SIGNAL}};
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTSTP);
+    sigaddset(&mask, SIGQUIT);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        unix_error("init_reactor: sigprocmask failed");
+    if ((signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+        unix_error("init_reactor: signalfd failed");
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        unix_error("init_reactor: epoll_create1 failed");
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev) < 0)
+        unix_error("init_reactor: epoll_ctl failed");
+    ev.data.u64 = EV_TICK;
+    if ((tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, tick_fd, &ev) < 0)
+        unix_error("init_reactor: timerfd failed");
+}
+
+/* watch_job - Add the pidfds of the job's processes to the set, if pidfds are supported */
+void watch_job(struct job_t *job)
+{
+#ifdef SYS_pidfd_open
+    struct epoll_event ev = {EPOLLIN, {.u64 = 0}};
+    struct job_stage *st;
+    int fd;
+    if (epoll_fd < 0 || job == NULL)
+        return;
+    for (int i = 0; i < job->nstages; i++) {
+        st = &job->stages[i];
+        if (!st->running || st->pidfd >= 0)
+            continue;
+        if ((fd = (int) syscall(SYS_pidfd_open, st->pid, 0)) < 0)
+            continue;   /* an old kernel, or it's gone: SIGCHLD will do */
+        ev.data.u64 = (uint64_t) st->pid;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            continue;
+        }
+        st->pidfd = fd;     /* closed, and so out of the set, once it's reaped */
+    }
+#endif
+}
+
+/* set_ticking - Arm or disarm the pipesz tick */
+static void set_ticking(int on)
+{
+    struct itimerspec its = {{0, on ? PIPE_TICK_NS : 0}, {0, on ? PIPE_TICK_NS : 0}};
+    if (on != ticking && timerfd_settime(tick_fd, 0, &its, NULL) == 0)
+        ticking = on;
+}
+
+/* arm_input - Ask for one event when fd can be read; returns -1 if it can't be polled */
+static int arm_input(int fd)
+{
+    struct epoll_event ev = {EPOLLIN | EPOLLONESHOT, {.u64 = EV_INPUT}};
+    if (fd != input_watched) {
+        if (input_watched >= 0 && input_polls)
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, input_watched, NULL);
+        input_watched = fd;
+        input_polls = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    } else if (input_polls) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+    return input_polls ? 0 : -1;
+}
+
+/* read_signals - Act on the signals queued on the signalfd */
+static void read_signals(void)
+{
+    struct signalfd_siginfo si;
+    while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+        switch (si.ssi_signo) {
+            case SIGCHLD:
+                reap_children();
+                break;
+            case SIGINT:
+                interrupt_fg(SIGINT);
+                break;
+            case SIGTSTP:
+                stop_fg(SIGTSTP);
+                break;
+            case SIGQUIT:
+                printf("terminating after receipt of SIGQUIT signal\n");
+                exit(1);
+        }
+    }
+}
+
+/* reap_job - Reap pid, a process of a job, whose pidfd says it has exited */
+static void reap_job(pid_t pid)
+{
+    struct rusage ru;
+    int status;
+    pid_t r;
+    while ((r = wait4(pid, &status, WNOHANG | WUNTRACED, &ru)) < 0 && errno == EINTR)
+        ;
+    if (r == pid) {
+        trace_exit(pid, status, &ru);
+        report_child(pid, status, &ru);
+    } else if (r < 0) {
+        report_child(pid, 0, NULL);     /* reaped by someone else */
+    }
+}
+
+/* tick - Sample the pipes pipesz auto watches */
+static void tick(void)
+{
+    uint64_t ticks;
+    if (read(tick_fd, &ticks, sizeof(ticks)) == sizeof(ticks))
+        grow_job_pipes(jobs);
+}
+
+/*
+ * run_reactor - Handle the events that come within timeout ms (-1 to wait
+ *     for one, 0 for only those pending). Returns 1 if input_fd (-1 for
+ *     none) can be read: it was ready, or it can't be polled.
+ */
+int run_reactor(int input_fd, int timeout)
+{
+    struct epoll_event ev[MAX_EVENTS];
+    int n, ready = 0;
+
+    if (epoll_fd < 0)
+        return 1;
+    if (input_fd >= 0 && arm_input(input_fd) < 0) {
+        ready = 1;
+        timeout = 0;
+    }
+    set_ticking(pipe_size_conf.mode == PIPESZ_AUTO && watching_pipes(jobs));
+    while ((n = epoll_wait(epoll_fd, ev, MAX_EVENTS, timeout)) < 0) {
+        if (errno != EINTR)
+            unix_error("run_reactor: epoll_wait failed");
+    }
+    for (int i = 0; i < n; i++) {
+        if (ev[i].data.u64 == EV_SIGNAL)
+            read_signals();
+        else if (ev[i].data.u64 == EV_INPUT)
+            ready = ready || input_fd == input_watched;
+        else if (ev[i].data.u64 == EV_TICK)
+            tick();
+        else
+            reap_job((pid_t) ev[i].data.u64);
+    }
+    return ready;
+}
+
+/*
+ * wait_input - Handle events until fd can be read. If before_notice isn't
+ *     NULL, it's called before a job notice is printed meanwhile, and the
+ *     wait ends after the events that printed one: returns 1 then, to
+ *     have the caller redraw what it had on the screen, and 0 once fd
+ *     can be read.
+ */
+int wait_input(int fd, void (*before_notice)(void))
+{
+    int ready;
+    do {
+        notice_hook = before_notice;
+        ready = run_reactor(fd, -1);
+    } while (!ready && notice_hook == before_notice);
+    if (notice_hook != before_notice) {
+        notice_hook = NULL;
+        return 1;
+    }
+    notice_hook = NULL;
+    return 0;
+}
+
+/* notice - Called before a job notice is printed */
+void notice(void)
+{
+    if (notice_hook != NULL) {
+        notice_hook();
+        notice_hook = NULL;
+    }
+}
+
+/*
+ * wait_signal - Wait for one of the signals the reactor reads and return
+ *     it, for a caller that acts on it itself: nothing is reaped.
+ */
+int wait_signal(void)
+{
+    struct signalfd_siginfo si;
+    struct pollfd p = {signal_fd, POLLIN, 0};
+    while (read(signal_fd, &si, sizeof(si)) != sizeof(si)) {
+        if (poll(&p, 1, -1) < 0 && errno != EINTR)
+            unix_error("wait_signal: poll failed");
+    }
+    return (int) si.ssi_signo;
+}
+
+/* reactor_running - Returns true in the shell, false in a forked child */
+int reactor_running(void)
+{
+    return epoll_fd >= 0;
+}
+
+/*
+ * reactor_child - Give a forked child the signals it would have had
+ *     without the reactor: none blocked. The set is the parent's.
+ */
+void reactor_child(void)
+{
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        close(signal_fd);
+        close(tick_fd);
+        epoll_fd = signal_fd = tick_fd = -1;
+    }
+}
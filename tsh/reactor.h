@@ -0,0 +1,22 @@
+#ifndef OS_HW_REACTOR_H
+#define OS_HW_REACTOR_H
+
+#include "job.h"
+
+void init_reactor(void);
+
+void watch_job(struct job_t *job);
+
+int run_reactor(int input_fd, int timeout);
+
+int wait_input(int fd, void (*before_notice)(void));
+
+void notice(void);
+
+int wait_signal(void);
+
+int reactor_running(void);
+
+void reactor_child(void);
+
+#endif //OS_HW_REACTOR_H
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "script.h"
+#include "reactor.h"
+#include "errmsg.h"
+
+#define SCRIPT_BUF (64 << 10)   /* read size when the script is streamed */
+#define LINE_INIT  256          /* first size of the line buffer */
+
+/*
+ * A script is read either from a private read-only mapping of the whole
+ * file (regular files), or by large reads into buf (stdin, pipes, ttys).
+ * Either way lines are found with memchr over data[pos, end) and copied
+ * into line, the only copy a line ever takes.
+ */
+struct script_record
+{
+    int fd;             /* -1 once the file is mapped */
+    char *data;         /* the mapping or buf */
+    size_t pos;         /* start of the next line in data */
+    size_t end;         /* end of the valid bytes in data */
+    size_t map_size;    /* size of the mapping, 0 when streamed */
+    char *line;         /* the line returned by read_script_line */
+    size_t line_cap;
+};
+
+/* refill - Read the next chunk of a streamed script, returns 0 at EOF */
+static ssize_t refill(script s)
+{
+    ssize_t n;
+    if (s->map_size > 0 || s->fd < 0)
+        return 0;
+    /* jobs that end while the shell waits for input are reaped meanwhile */
+    wait_input(s->fd, NULL);
+    while ((n = read(s->fd, s->data, SCRIPT_BUF)) < 0 && errno == EINTR)
+        ;
+    if (n < 0)
+        unix_error("read_script_line: read failed");
+    s->pos = 0;
+    s->end = (size_t) n;
+    return n;
+}
+
+/* append - Add n bytes at p to the line, which holds len bytes */
+static void append(script s, size_t len, const char *p, size_t n)
+{
+    char *line;
+    size_t cap = s->line_cap;
+    while (len + n + 1 > cap)
+        cap *= 2;
+    if (cap != s->line_cap) {
+        if ((line = realloc(s->line, cap)) == NULL)
+            app_error("out of space!!");
+        s->line = line;
+        s->line_cap = cap;
+    }
+    memcpy(s->line + len, p, n);
+}
+
+/*
+ * open_script - Open a script for reading, stdin if filename is NULL.
+ *     Regular files are mapped, anything else is streamed. stdin is
+ *     always streamed, so commands that read it go on from where the
+ *     shell's last read stopped, as they did with stdio.
+ */
+script open_script(const char *filename)
+{
+    script s;
+    struct stat st;
+    void *map;
+    if ((s = calloc(1, sizeof(struct script_record))) == NULL) {
+        app_error("out of space!!");
+        return NULL;
+    }
+    if ((s->line = malloc(LINE_INIT)) == NULL)
+        app_error("out of space!!");
+    s->line_cap = LINE_INIT;
+    if (filename == NULL) {
+        s->fd = STDIN_FILENO;
+    } else if ((s->fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) {
+        free(s->line);
+        free(s);
+        return NULL;
+    } else if (fstat(s->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {      /* nothing to map */
+            close(s->fd);
+            s->fd = -1;
+            return s;
+        }
+        map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, s->fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+            close(s->fd);
+            s->fd = -1;
+            s->data = map;
+            s->end = s->map_size = (size_t) st.st_size;
+            return s;
+        }
+    }
+    if ((s->data = malloc(SCRIPT_BUF)) == NULL)
+        app_error("out of space!!");
+    return s;
+}
+
+/*
+ * read_script_line - Returns the next line, with its '\n' if it had one,
+ *     or NULL at the end of the script. The line is overwritten by the
+ *     next call.
+ */
+char *read_script_line(script s)
+{
+    const char *p, *nl;
+    size_t len = 0, n;
+    for (;;) {
+        if (s->pos == s->end && refill(s) == 0)
+            break;
+        p = s->data + s->pos;
+        nl = memchr(p, '\n', s->end - s->pos);
+        n = nl != NULL ? (size_t) (nl - p) + 1 : s->end - s->pos;
+        append(s, len, p, n);
+        len += n;
+        s->pos += n;
+        if (nl != NULL)
+            break;
+    }
+    if (len == 0)
+        return NULL;
+    s->line[len] = '\0';
+    return s->line;
+}
+
+void close_script(script s)
+{
+    if (s->map_size > 0)
+        munmap(s->data, s->map_size);
+    else
+        free(s->data);
+    if (s->fd > STDIN_FILENO)
+        close(s->fd);
+    free(s->line);
+    free(s);
+}
@@ -0,0 +1,14 @@
+#ifndef OS_HW_SCRIPT_H
+#define OS_HW_SCRIPT_H
+
+struct script_record;
+
+typedef struct script_record *script;
+
+script open_script(const char *filename);
+
+char *read_script_line(script s);
+
+void close_script(script s);
+
+#endif //OS_HW_SCRIPT_H
@@ -2,11 +2,14 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <errno.h>
 
 #include "sigutil.h"
 #include "errmsg.h"
 #include "job.h"
+#include "trace.h"
+#include "reactor.h"
 
 typedef void handler_t(int);
 
@@ -47,39 +50,30 @@ handler_t *bind_signal(int signum, handler_t *handler)
     return old_action.sa_handler;
 }
 
-/*
- * sigquit_handler - The driver program can gracefully terminate the
- *    child shell by sending it a SIGQUIT signal.
- */
-void sigquit_handler(int sig)
-{
-    printf("siquit_handler: terminating after receipt of SIGQUIT signal\n");
-    exit(1);
-}
+/* job_notices - Print "Done" when a background job exits: on for a terminal */
+int job_notices = 0;
 
 /*
- * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
- *     the user types ctrl-z at the keyboard. Catch it and suspend the
- *     foreground job by sending it a SIGTSTP.
+ * stop_fg - Called for ctrl-z (SIGTSTP to the shell), and when the
+ *     foreground job stops. Suspend the job by sending it the signal.
  */
-void sigtstp_handler(int sig)
+void stop_fg(int sig)
 {
     pid_t pid = fgpid(jobs);
     int jid = pid2jid(pid);
 
     if (pid != 0) {
         printf("Job [%d] (%d) stopped by signal %d\n", jid, pid, sig);
-        getjobpid(jobs, pid)->state = ST;
+        setjobstate(jobs, getjobpid(jobs, pid), ST);
         send_signal(-pid, sig);
     }
 }
 
 /*
- * sigint_handler - The kernel sends a SIGINT to the shell whenver the
- *    user types ctrl-c at the keyboard.  Catch it and send it along
- *    to the foreground job.
+ * interrupt_fg - Called for ctrl-c (SIGINT to the shell), and when the
+ *     foreground job is interrupted. Send the signal along to the job.
  */
-void sigint_handler(int sig)
+void interrupt_fg(int sig)
 {
     pid_t pid = fgpid(jobs);
     int jid = pid2jid(pid);
@@ -92,32 +86,55 @@ void sigint_handler(int sig)
 }
 
 /*
- * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
- *     a child job terminates (becomes a zombie), or stops because it
- *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
- *     available zombie children, but doesn't wait for any other
- *     currently running children to terminate.
+ * report_child - Update the job list for a status change of child pid,
+ *     as reported by wait4 with its resource usage ru (NULL if unknown).
+ *     A pipeline ends with its last stage, with the status of the stage
+ *     at its end.
+ */
+void report_child(pid_t pid, int status, const struct rusage *ru)
+{
+    struct job_t *job = getjobpid(jobs, pid);
+    if (WIFSTOPPED(status)) {
+        if (job != NULL && job->state == FG)    /* not a stage of a job stopped already */
+            stop_fg(WSTOPSIG(status));
+        return;
+    }
+    if (job == NULL)
+        return;     /* its job was interrupted already */
+    if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT && job->state == FG) {
+        finishjob(jobs, pid, status, ru);
+        interrupt_fg(SIGINT);
+        return;
+    }
+    if (finishjob(jobs, pid, status, ru) > 0)
+        return;     /* the rest of the pipeline is still running */
+    status = job->stages[job->nstages - 1].status;
+    if (WIFSIGNALED(status)) {
+        notice();
+        printf("Job [%d] (%d) terminated by signal %d\n", job->jid, job->pid, WTERMSIG(status));
+    } else if (job_notices && job->state == BG) {
+        notice();
+        printf("[%d] (%d) Done       %s", job->jid, job->pid, job->cmdline);
+        fflush(stdout);
+    }
+    deletejob(jobs, job->pid); /* remove the job */
+}
+
+/*
+ * reap_children - Reap all available zombie children and handle their
+ *     status reports, without waiting for the ones still running. Called
+ *     by the reactor when a SIGCHLD comes in.
  */
-void sigchld_handler(int sig)
+void reap_children(void)
 {
     pid_t pid;
-    int status, child_sig;
+    int status;
+    struct rusage ru;
 
-    /* reap any zombies and handle status reports */
-    while ((pid = waitpid(-1, &status, WUNTRACED | WNOHANG)) > 0) {
-        if (WIFSTOPPED(status)) {
-            sigtstp_handler(WSTOPSIG(status));
-        } else if (WIFSIGNALED(status)) {
-            child_sig = WTERMSIG(status);
-            if (child_sig == SIGINT)
-                sigint_handler(child_sig);
-            else
-                unix_error("sigchld_handler: uncaught signal\n");
-        } else {
-            deletejob(jobs, pid); /* remove the job */
-        }
+    while ((pid = wait4(-1, &status, WUNTRACED | WNOHANG, &ru)) > 0) {
+        trace_exit(pid, status, &ru);
+        report_child(pid, status, &ru);
     }
-    if (pid == -1 && errno != ECHILD)
-        unix_error("sigchld_handler: waitpid error");
-    return;
+    if (pid == -1 && errno != ECHILD && errno != EINTR)
+        unix_error("reap_children: waitpid error");
 }
@@ -9,12 +9,16 @@ int send_signal(pid_t pid, int sig);
 
 handler_t *bind_signal(int signum, handler_t *handler);
 
-void sigquit_handler(int sig);
+extern int job_notices;
 
-void sigtstp_handler(int sig);
+void stop_fg(int sig);
 
-void sigint_handler(int sig);
+void interrupt_fg(int sig);
 
-void sigchld_handler(int sig);
+struct rusage;
+
+void report_child(pid_t pid, int status, const struct rusage *ru);
+
+void reap_children(void);
 
 #endif //OS_HW_SIGUTIL_H
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <spawn.h>
+
+#include "spawn.h"
+#include "pathcache.h"
+#include "util.h"
+
+extern char **environ;
+
+int launch_mode = LAUNCH_FORK;
+
+/*
+ * set_launch_mode - Select the launch mode by name ("fork" or "spawn").
+ *     Returns 0 on success, -1 if the name is unknown.
+ */
+int set_launch_mode(const char *name)
+{
+    if (!strcmp(name, "fork")) {
+        launch_mode = LAUNCH_FORK;
+    } else if (!strcmp(name, "spawn")) {
+        launch_mode = LAUNCH_SPAWN;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char *launch_mode_name(void)
+{
+    return launch_mode == LAUNCH_SPAWN ? "spawn" : "fork";
+}
+
+/*
+ * spawn_cmd - Launch argv[0] (resolved through the PATH cache) with
+ *     posix_spawn, which glibc implements with clone(CLONE_VM|CLONE_VFORK),
+ *     so the cost doesn't grow with the shell's RSS.
+ *
+ *     input_fd/output_fd become the child's stdin/stdout (-1 to inherit).
+ *     pgid is the child's process group (0 for a new group, -1 to inherit).
+ *     close_fds are closed in the child after the redirections (input_fd
+ *     and output_fd themselves are always closed once duplicated).
+ *     A /dev/fd/N argument keeps fd N open across the exec.
+ *     The child starts with an empty signal mask and SIGPIPE at its
+ *     default, even if the caller ignores it.
+ *
+ *     Returns the child pid, or -1 if the command couldn't be launched.
+ */
+pid_t spawn_cmd(char **argv, int input_fd, int output_fd, pid_t pgid,
+                const int *close_fds, int nclose)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t empty, dfl;
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    const char *path;
+    pid_t pid;
+    int err;
+    int fd;
+
+    if ((path = lookup_path(argv[0])) == NULL) {
+        fprintf(stderr, "%s: Command not found.\n", argv[0]);
+        return -1;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    if (input_fd != -1 && input_fd != STDIN_FILENO)
+        posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+    if (output_fd != -1 && output_fd != STDOUT_FILENO)
+        posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+    for (int i = 0; i < nclose; i++)
+        if (close_fds[i] != input_fd && close_fds[i] != output_fd)
+            posix_spawn_file_actions_addclose(&actions, close_fds[i]);
+    for (int i = 0; argv[i] != NULL; i++)
+        if ((fd = dev_fd_arg(argv[i])) > STDERR_FILENO)
+            posix_spawn_file_actions_adddup2(&actions, fd, fd);  /* clears FD_CLOEXEC */
+    if (input_fd > STDERR_FILENO)
+        posix_spawn_file_actions_addclose(&actions, input_fd);
+    if (output_fd > STDERR_FILENO && output_fd != input_fd)
+        posix_spawn_file_actions_addclose(&actions, output_fd);
+
+    posix_spawnattr_init(&attr);
+    sigemptyset(&empty);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    sigemptyset(&dfl);
+    sigaddset(&dfl, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &dfl);
+    if (pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, pgid);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    err = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err == ENOENT) {
+        fprintf(stderr, "%s: Command not found.\n", argv[0]);
+        return -1;
+    } else if (err != 0) {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(err));
+        return -1;
+    }
+    return pid;
+}
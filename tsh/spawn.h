@@ -0,0 +1,19 @@
+#ifndef OS_HW_SPAWN_H
+#define OS_HW_SPAWN_H
+
+#include <sys/types.h>
+
+/* Launch modes */
+#define LAUNCH_FORK  0  /* fork() then execvp() in the child */
+#define LAUNCH_SPAWN 1  /* posix_spawnp(), no page table copy */
+
+extern int launch_mode;
+
+int set_launch_mode(const char *name);
+
+const char *launch_mode_name(void);
+
+pid_t spawn_cmd(char **argv, int input_fd, int output_fd, pid_t pgid,
+                const int *close_fds, int nclose);
+
+#endif //OS_HW_SPAWN_H
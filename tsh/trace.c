@@ -0,0 +1,266 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "trace.h"
+#include "job.h"
+
+#define TRACE_BUF     (64 << 10)    /* events buffered before a write */
+#define TRACE_FLUSH   (48 << 10)    /* flush once this much is buffered */
+
+/*
+ * Events are JSON objects, one per line, built straight into a buffer
+ * with the append functions below (no stdio). An event only counts once
+ * trace_end commits it, so a flush never writes half an event. Exits are
+ * recorded by the reactor, in the same buffer, so every event comes out
+ * in the order it happened.
+ *
+ * The file is opened O_NONBLOCK: if it's a pipe whose reader can't keep
+ * up, what couldn't be written stays in the buffer, and events that
+ * don't fit in it any more are dropped (and counted) whole rather than
+ * slowing the shell.
+ */
+struct trace_buf
+{
+    char *data;
+    size_t cap;
+    size_t len;         /* committed events */
+    size_t pos;         /* end of the event being built */
+    int overflow;       /* the event being built didn't fit */
+};
+
+int trace_fd = -1;
+
+static char main_data[TRACE_BUF];
+static struct trace_buf main_buf = {main_data, TRACE_BUF, 0, 0, 0};
+static long dropped;    /* events lost to a full buffer */
+
+/* put - Append n bytes to the event being built */
+static void put(struct trace_buf *b, const char *s, size_t n)
+{
+    if (b->pos + n > b->cap && b->len > 0)
+        trace_flush();  /* moves the event being built to the front */
+    if (b->pos + n > b->cap) {
+        b->overflow = 1;
+        return;
+    }
+    memcpy(b->data + b->pos, s, n);
+    b->pos += n;
+}
+
+static void put_long(struct trace_buf *b, long v)
+{
+    char digits[24];
+    int i = sizeof(digits);
+    unsigned long u = v < 0 ? -(unsigned long) v : (unsigned long) v;
+    do {
+        digits[--i] = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (v < 0)
+        digits[--i] = '-';
+    put(b, digits + i, sizeof(digits) - i);
+}
+
+/* put_string - Append s as a JSON string */
+static void put_string(struct trace_buf *b, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+    char esc[6] = {'\\', 'u', '0', '0'};
+    const char *run = s;
+    put(b, "\"", 1);
+    for (; *s != '\0'; s++) {
+        if (*s != '"' && *s != '\\' && (unsigned char) *s >= 0x20)
+            continue;
+        put(b, run, s - run);
+        if (*s == '"' || *s == '\\') {
+            esc[1] = *s;
+            put(b, esc, 2);
+        } else {
+            esc[1] = 'u';
+            esc[4] = hex[(unsigned char) *s >> 4];
+            esc[5] = hex[*s & 0xf];
+            put(b, esc, 6);
+        }
+        run = s + 1;
+    }
+    put(b, run, s - run);
+    put(b, "\"", 1);
+}
+
+static void put_key(struct trace_buf *b, const char *key)
+{
+    put(b, ",", 1);
+    put_string(b, key);
+    put(b, ":", 1);
+}
+
+static void begin(struct trace_buf *b, const char *event)
+{
+    b->pos = b->len;
+    b->overflow = 0;
+    put(b, "{\"ev\":", 6);
+    put_string(b, event);
+    put_key(b, "t");
+    put_long(b, trace_now());
+    put_key(b, "proc");
+    put_long(b, getpid());
+}
+
+/* end - Commit the event being built, or drop it if it didn't fit */
+static void end(struct trace_buf *b)
+{
+    put(b, "}\n", 2);
+    if (b->overflow)
+        dropped++;
+    else
+        b->len = b->pos;
+    b->pos = b->len;
+}
+
+/* open_trace - Start tracing to filename, returns -1 if it can't be opened */
+int open_trace(const char *filename)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    trace_fd = fd;
+    atexit(trace_flush);
+    return 0;
+}
+
+/* trace_now - Wall clock time in microseconds */
+long trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/* trace_begin - Start an event; add fields with trace_int/str/argv, then trace_end */
+void trace_begin(const char *event)
+{
+    begin(&main_buf, event);
+}
+
+void trace_int(const char *key, long value)
+{
+    put_key(&main_buf, key);
+    put_long(&main_buf, value);
+}
+
+void trace_str(const char *key, const char *value)
+{
+    put_key(&main_buf, key);
+    put_string(&main_buf, value);
+}
+
+/* trace_argv - Add argv, up to its NULL, as an array of strings */
+void trace_argv(const char *key, char **argv)
+{
+    put_key(&main_buf, key);
+    put(&main_buf, "[", 1);
+    for (int i = 0; argv[i] != NULL; i++) {
+        if (i > 0)
+            put(&main_buf, ",", 1);
+        put_string(&main_buf, argv[i]);
+    }
+    put(&main_buf, "]", 1);
+}
+
+/* trace_end - Commit the event, flushing once enough is buffered */
+void trace_end(void)
+{
+    end(&main_buf);
+    if (main_buf.len >= TRACE_FLUSH)
+        trace_flush();
+}
+
+/* trace_exit - Record a child's exit or stop as reported by wait4 */
+void trace_exit(pid_t pid, int status, const struct rusage *ru)
+{
+    struct trace_buf *b = &main_buf;
+    int jid;
+    if (!tracing())
+        return;
+    begin(b, WIFSTOPPED(status) ? "stop" : "exit");
+    put_key(b, "pid");
+    put_long(b, pid);
+    if ((jid = pid2jid(pid)) > 0) {
+        put_key(b, "jid");
+        put_long(b, jid);
+    }
+    if (WIFEXITED(status)) {
+        put_key(b, "status");
+        put_long(b, WEXITSTATUS(status));
+    } else {
+        put_key(b, "signal");
+        put_long(b, WIFSTOPPED(status) ? WSTOPSIG(status) : WTERMSIG(status));
+    }
+    if (ru != NULL && !WIFSTOPPED(status)) {
+        put_key(b, "user_us");
+        put_long(b, ru->ru_utime.tv_sec * 1000000L + ru->ru_utime.tv_usec);
+        put_key(b, "sys_us");
+        put_long(b, ru->ru_stime.tv_sec * 1000000L + ru->ru_stime.tv_usec);
+        put_key(b, "maxrss");
+        put_long(b, ru->ru_maxrss);
+    }
+    end(b);
+}
+
+/*
+ * write_buf - Write out the committed events of b. What a full pipe
+ *     doesn't take is kept, to go out with the next flush.
+ */
+static void write_buf(struct trace_buf *b)
+{
+    size_t done = 0;
+    ssize_t n;
+    while (done < b->len) {
+        if ((n = write(trace_fd, b->data + done, b->len - done)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        done += n;
+    }
+    memmove(b->data, b->data + done, b->pos - done);
+    b->len -= done;
+    b->pos -= done;
+}
+
+/* trace_flush - Write out every committed event */
+void trace_flush(void)
+{
+    if (!tracing())
+        return;
+    if (dropped > 0 && main_buf.pos == main_buf.len) {
+        long n = dropped;
+        dropped = 0;
+        trace_begin("dropped");
+        trace_int("events", n);
+        end(&main_buf);
+        if (dropped > 0)
+            dropped = n;    /* no room for the count either: report it later */
+    }
+    write_buf(&main_buf);
+}
+
+/*
+ * trace_fork - fork, but the child starts with empty trace buffers, so it
+ *     never writes out events of its parent's.
+ */
+pid_t trace_fork(void)
+{
+    pid_t pid = fork();
+    if (pid == 0 && tracing()) {
+        main_buf.len = main_buf.pos = 0;
+        dropped = 0;
+    }
+    return pid;
+}
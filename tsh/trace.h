@@ -0,0 +1,33 @@
+#ifndef OS_HW_TRACE_H
+#define OS_HW_TRACE_H
+
+#include <sys/types.h>
+
+struct rusage;
+
+/* The trace file, -1 when tracing is off */
+extern int trace_fd;
+
+#define tracing() (trace_fd >= 0)
+
+int open_trace(const char *filename);
+
+long trace_now(void);
+
+void trace_begin(const char *event);
+
+void trace_int(const char *key, long value);
+
+void trace_str(const char *key, const char *value);
+
+void trace_argv(const char *key, char **argv);
+
+void trace_end(void);
+
+void trace_exit(pid_t pid, int status, const struct rusage *ru);
+
+void trace_flush(void);
+
+pid_t trace_fork(void);
+
+#endif //OS_HW_TRACE_H
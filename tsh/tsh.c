@@ -12,44 +12,52 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "errmsg.h"
 #include "job.h"
 #include "sigutil.h"
-#include "stack.h"
 #include "util.h"
 #include "bookmark.h"
-
-/* Misc manifest constants */
-#define MAXLINE         1024  /* max line size */
-#define MAXARGS         128   /* max args on a command line */
-#define MAXPIPE         128
-#define HISTORY_LIMIT   256
-
-/* command line prompt */
-static int current = 0;
-
-static char cmd_history[HISTORY_LIMIT][MAXLINE];
-
-static char cwd[MAXLINE];
-
-static char buf[MAXLINE];
+#include "spawn.h"
+#include "pipesize.h"
+#include "parse.h"
+#include "exec.h"
+#include "script.h"
+#include "parallel.h"
+#include "trace.h"
+#include "history.h"
+#include "histsearch.h"
+#include "complete.h"
+#include "lineedit.h"
+#include "frecency.h"
+#include "reactor.h"
+
+/* matches cdb -l lists */
+#define JUMP_LIST 10
+
+static char cwd[PATH_MAX];
+
+/* Commands run by builtin_cmd, besides the stage builtins */
+static const char *builtin_names[] = {
+    "quit", "exit", "&", "cd", "cdb", "addb", "rmb", "bg", "fg", "wait", "pipesz", "launcher", "fc", "time", NULL
+};
 
 void eval(const char *cmdline);
 
-int parse_line(const char *cmdline, int *p_argc, char **argv);
+int is_builtin(const char *name);
 
-int parse_pipe(int argc, char **argv, int *cmd_postions);
+void parallel_loop(script sp, int max_jobs, int quiet);
 
-void parse_redirect(char **argv, int *input_fd, int *output_fd);
-
-void history_exec(int start, int n);
+void history_exec(long start, long n);
 
 void save_history(const char *cmd);
 
-void change_dir(const char *path);
+void time_line(pid_t pid, struct job_usage *usage, const struct rusage *self);
 
-int subs_exec(int argc, char **argv);
+void trace_cmd(int argc, char **argv, int bg, long t_parse, long t_parsed, long t_fork, pid_t pid);
+
+void change_dir(const char *path);
 
 void usage(void);
 
@@ -59,9 +67,13 @@ void usage(void);
 int main(int argc, char **argv)
 {
     char c;
-    char cmdline[MAXLINE];
-    FILE *fp;
+    char *cmdline;
+    script sp;
     int bash_mode = 0; /* emit prompt (default) */
+    int quiet = 0;     /* echo and flush every script line (default) */
+    int max_jobs = 1;  /* script lines run at a time */
+    int editing;       /* read lines with edit_line */
+    char prompt[PATH_MAX + 4];
 
     load_bookmarks(NULL);
 
@@ -70,129 +82,163 @@ int main(int argc, char **argv)
     dup2(1, 2);
 
     /* Parse the command line */
-    while ((c = (char) getopt(argc, argv, "hp")) != EOF) {
+    while ((c = (char) getopt(argc, argv, "Bhj:pqsT:w")) != EOF) {
         switch (c) {
+            case 'B':             /* launch echo, test ... instead of running them */
+                fast_builtins = 0;
+                break;
             case 'h':             /* print help message */
                 usage();
                 break;
+            case 'j':             /* run up to N script lines at a time */
+                if ((max_jobs = atoi(optarg)) < 1)
+                    usage();
+                break;
             case 'p':             /* don't print a prompt */
                 bash_mode = 0;  /* handy for automatic testing */
                 break;
+            case 'q':             /* don't echo script lines */
+                quiet = 1;
+                break;
+            case 's':             /* launch commands with posix_spawn */
+                launch_mode = LAUNCH_SPAWN;
+                break;
+            case 'T':             /* trace every command to a JSONL file */
+                if (open_trace(optarg) < 0)
+                    unix_error(optarg);
+                break;
+            case 'w':             /* report shell cpu time in waitfg */
+                waitfg_report = 1;
+                break;
             default:
                 usage();
         }
     }
 
-    /* Install the signal handlers */
-    bind_signal(SIGINT, sigint_handler);   /* ctrl-c */
-    bind_signal(SIGTSTP, sigtstp_handler);  /* ctrl-z */
-    bind_signal(SIGCHLD, sigchld_handler);  /* terminated or stopped child */
-    bind_signal(SIGQUIT, sigquit_handler);  /* so parent can cleanly terminate child*/
+    if (!tracing() && getenv("TSH_TRACE") != NULL && open_trace(getenv("TSH_TRACE")) < 0)
+        unix_error(getenv("TSH_TRACE"));
+
+    /* ctrl-c, ctrl-z, children and SIGQUIT are handled in the reactor */
+    init_reactor();
 
     /* Initialize the job list */
     initjobs(jobs);
+    cmd_arena = create_arena(0);
 
-    if (argc > 1 && argv[1][0] != '-') {
-        fp = fopen(argv[1], "r");
+    if (optind < argc) {
+        if ((sp = open_script(argv[optind])) == NULL)
+            unix_error(argv[optind]);
         bash_mode = 1;
     } else {
-        fp = stdin;
+        sp = open_script(NULL);
     }
 
+    /* a terminal session shares ~/.tsh_history and ~/.tsh_dirs; scripts keep them in memory */
+    if (getenv("TSH_HISTORY") != NULL)
+        open_history(getenv("TSH_HISTORY"));
+    else if (optind == argc && isatty(STDIN_FILENO))
+        open_history(NULL);
+    if (getenv("TSH_DIRS") != NULL)
+        open_dirs(getenv("TSH_DIRS"));
+    else if (optind == argc && isatty(STDIN_FILENO))
+        open_dirs(NULL);
+
+    if (bash_mode && max_jobs > 1)
+        parallel_loop(sp, max_jobs, quiet);
+
+    /* a prompt gets told when background jobs are done */
+    job_notices = !bash_mode;
+
+    /* a terminal gets the line editor */
+    if ((editing = !bash_mode && isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)))
+        init_completion(builtin_names);
+
     /* Execute the shell's read/eval loop */
     while (1) {
         /* Read command line */
-        if (!bash_mode) {
-            getcwd(cwd, MAXLINE);
-            printf("%s $ ", cwd);
+        if (editing) {
+            getcwd(cwd, sizeof(cwd));
+            snprintf(prompt, sizeof(prompt), "%s $ ", cwd);
             fflush(stdout);
+            cmdline = edit_line(prompt);
+        } else {
+            if (!bash_mode) {
+                getcwd(cwd, sizeof(cwd));
+                printf("%s $ ", cwd);
+                fflush(stdout);
+            }
+            cmdline = read_script_line(sp);
         }
-        if ((fgets(cmdline, MAXLINE, fp) == NULL) && ferror(fp))
-            app_error("fgets error");
-        if (feof(fp)) { /* End of file (ctrl-d) */
+        if (cmdline == NULL) { /* End of file (ctrl-d) */
             fflush(stdout);
             exit(0);
         }
-        if (bash_mode) {
+        if (bash_mode && !quiet) {
             printf("%s", cmdline);
         }
 
-        /* Evaluate the command line */
+        /* Evaluate the command line, then reap what ended meanwhile */
         eval(cmdline);
-        fflush(stdout);
-        fflush(stderr);
+        clear_arena(cmd_arena);
+        run_reactor(-1, 0);
+        if (!quiet) {
+            fflush(stdout);
+            fflush(stderr);
+        }
     }
 
     exit(0); /* control never reaches here */
 }
 
-void single_exec(char **argv, int input_fd, int output_fd)
+
+/* is_builtin - Returns true if name is run by builtin_cmd */
+int is_builtin(const char *name)
 {
-    parse_redirect(argv, &input_fd, &output_fd);
-    if (output_fd != -1) {
-        dup2(output_fd, STDOUT_FILENO);
-        close(output_fd);
-    }
-    if (input_fd != -1) {
-        dup2(input_fd, STDIN_FILENO);
-        close(input_fd);
-    }
-    if (execvp(argv[0], argv) < 0) {
-        fprintf(stderr, "%s: Command not found.\n", argv[0]);
-        exit(1);
+    for (int i = 0; builtin_names[i] != NULL; i++) {
+        if (!strcmp(builtin_names[i], name))
+            return 1;
     }
+    return find_stage_builtin(name) != NULL;
 }
 
-void pipe_exec(char **argv, int *pos, int cmd_count)
+/*
+ * parallel_loop - Run a script with up to max_jobs lines at a time, and
+ *     exit with the number of lines that failed. A line that runs a
+ *     builtin changes the shell itself, and a line ending in & starts a
+ *     background job of the shell, so either waits for the lines before
+ *     it and runs alone, like in the normal read/eval loop.
+ */
+void parallel_loop(script sp, int max_jobs, int quiet)
 {
-    int i, j, k;
-    int result;
-    int status;
-    int pipe_count = cmd_count - 1;
-    int pipefds[2 * pipe_count];
-    for (i = 0; i < pipe_count; i++) {
-        if (pipe(pipefds + i * 2) < 0) {
-            fprintf(stderr, "couldn't pipe");
-            exit(1);
+    char *cmdline;
+    char **argv;
+    int argc;
+    int bg;
+    int timed;
+
+    init_parallel(max_jobs, !quiet);
+    while (!parallel_interrupted() && (cmdline = read_script_line(sp)) != NULL) {
+        bg = parse_line(cmdline, &argc, &argv, cmd_arena);
+        /* time <line> runs where the line would */
+        if ((timed = argc > 1 && !strcmp(argv[0], "time"))) {
+            argv++;
+            argc--;
         }
-    }
-    j = 0;
-    result = 0;
-    for (i = 0; i < cmd_count; i++, j += 2) {
-        if (fork() == 0) {
-            if (i != cmd_count - 1) {
-                dup2(pipefds[j + 1], STDOUT_FILENO);
-            }
-            if (i != 0) {
-                dup2(pipefds[j - 2], STDIN_FILENO);
-            }
-            for (k = 0; k < 2 * pipe_count; k++) {
-                if (k != j + 1 && k != j - 2) {
-                    close(pipefds[k]);
-                }
-            }
-            single_exec(argv + pos[i], -1, -1);
+        if (argc == 0 || (!bg && (has_pipe(argc, argv) || !is_builtin(argv[0]) ||
+                                  is_fast_builtin(argv[0])))) {
+            resolve_cmds(argc, argv);
+            start_parallel(argc, argv, cmdline, timed);
+        } else {
+            drain_parallel();
+            if (!quiet)
+                printf("%s", cmdline);
+            eval(cmdline);
+            fflush(stdout);
         }
+        clear_arena(cmd_arena);
     }
-    for (i = 0; i < 2 * pipe_count; i++) {
-        close(pipefds[i]);
-    }
-    for (i = 0; i < cmd_count; i++) {
-        wait(&status);
-        result |= status;
-    }
-    exit(result);
-}
-
-void line_exec(int argc, char **argv, int input_fd, int output_fd)
-{
-    int cmd_postions[MAXPIPE];
-    int cmd_count = parse_pipe(argc, argv, cmd_postions);
-    if (cmd_count > 1) {
-        pipe_exec(argv, cmd_postions, cmd_count);
-    } else {
-        single_exec(argv, input_fd, output_fd);
-    }
+    drain_parallel();
+    exit(min(parallel_failures(), PAR_MAX_STATUS));
 }
 
 /*
@@ -202,13 +248,13 @@ void line_exec(int argc, char **argv, int input_fd, int output_fd)
 int builtin_cmd(int argc, char **argv, int input_fd, int output_fd)
 {
     if (!strcmp(argv[0], "quit") || !strcmp(argv[0], "exit")) {
-        save_bookmarks(NULL);
+        save_bookmarks();
         exit(0);
     }
     if (!strcmp(argv[0], "&"))    /* Ignore singleton & */
         return 1;
-    if (!strcmp(argv[0], "jobs")) {
-        listjobs(jobs, output_fd);
+    if (find_stage_builtin(argv[0]) != NULL) {
+        setfgstatus(stage_exec(argv, input_fd, output_fd));
         return 1;
     }
     if (!strcmp(argv[0], "cd")) {
@@ -218,9 +264,12 @@ int builtin_cmd(int argc, char **argv, int input_fd, int output_fd)
         return 1;
     }
     if (!strcmp(argv[0], "cdb")) {
-        if (argc >= 2) {
-            char *path = get_bookmark(argv[1]);
-            if (!path) {
+        if (argc >= 3 && !strcmp(argv[1], "-l")) {
+            /* the best matches, bookmarks and visited directories */
+            list_jumps(output_fd, join_args(argc - 2, argv + 2, cmd_arena), JUMP_LIST);
+        } else if (argc >= 2) {
+            const char *path = argc == 2 ? get_bookmark(argv[1]) : NULL;
+            if (!path && !(path = jump_dir(join_args(argc - 1, argv + 1, cmd_arena)))) {
                 printf("cdb: %s: Unavailable bookmark\n", argv[1]);
             } else {
                 change_dir(path);
@@ -230,9 +279,13 @@ int builtin_cmd(int argc, char **argv, int input_fd, int output_fd)
     }
     if (!strcmp(argv[0], "addb")) {
         if (argc >= 3) {
-            char resolved_path[MAXLINE];
-            realpath(argv[2], resolved_path);
-            add_bookmark(argv[1], resolved_path);
+            char *resolved_path = realpath(argv[2], NULL);
+            if (resolved_path == NULL) {
+                printf("addb: %s: No such file or directory\n", argv[2]);
+            } else {
+                add_bookmark(argv[1], resolved_path);
+                free(resolved_path);
+            }
         }
         return 1;
     }
@@ -244,20 +297,48 @@ int builtin_cmd(int argc, char **argv, int input_fd, int output_fd)
         }
         return 1;
     }
-    if (!strcmp(argv[0], "lsb")) {
-        list_bookmarks();
-        return 1;
-    }
     if (!strcmp(argv[0], "bg") || !(strcmp(argv[0], "fg"))) {
         do_bgfg(argv, output_fd);
         return 1;
     }
+    if (!strcmp(argv[0], "wait")) {
+        wait_jobs(argv);
+        return 1;
+    }
+    if (!strcmp(argv[0], "pipesz")) {
+        if (argc < 2) {
+            print_pipe_size(output_fd);
+        } else if (!strcmp(argv[1], "-v") || !strcmp(argv[1], "-q")) {
+            pipe_size_conf.verbose = argv[1][1] == 'v';
+        } else if (parse_pipe_size(argv[1], &pipe_size_conf) < 0) {
+            printf("pipesz: %s: must be default, auto or a size in bytes\n", argv[1]);
+        }
+        return 1;
+    }
+    if (!strcmp(argv[0], "launcher")) {
+        if (argc < 2) {
+            printf("%s\n", launch_mode_name());
+        } else if (set_launch_mode(argv[1]) < 0) {
+            printf("launcher: %s: must be fork or spawn\n", argv[1]);
+        }
+        return 1;
+    }
     if (!strcmp(argv[0], "fc")) {
-        if (argc >= 3 && argv[1][0] == '-' && argv[2][0] == '-') {
+        if (argc >= 3 && (!strcmp(argv[1], "-s") || !strcmp(argv[1], "-g"))) {
+            /* the last command starting with (-s) or containing (-g) the words */
+            char *pattern = join_args(argc - 2, argv + 2, cmd_arena);
+            long n = search_history(pattern, argv[1][1] == 's' ? MATCH_PREFIX : MATCH_SUBSTRING,
+                                    history_count());
+            if (n < 0) {
+                fflush(stdout);
+                fprintf(stderr, "fc: %s: no command found\n", pattern);
+            } else {
+                history_exec(n, 1);
+            }
+        } else if (argc >= 3 && argv[1][0] == '-' && argv[2][0] == '-') {
             int a = atoi(argv[1] + 1);
             int b = atoi(argv[2] + 1);
-            int start = (current - max(a, b) + HISTORY_LIMIT) % HISTORY_LIMIT;
-            history_exec(start, sub(a, b) + 1);
+            history_exec(history_count() - max(a, b), sub(a, b) + 1);
         } else {
             fprintf(stderr, "fc: argument error!\n");
         }
@@ -270,209 +351,189 @@ int builtin_cmd(int argc, char **argv, int input_fd, int output_fd)
  * eval - Evaluate the command line that the user has just typed in
  *
  * If the user has requested a built-in command (quit, jobs, bg or fg)
- * then execute it immediately. Otherwise, fork a child process and
- * run the job in the context of the child. If the job is running in
- * the foreground, wait for it to terminate and then return.  Note:
- * each child process must have a unique process group ID so that our
- * background children don't receive SIGINT (SIGTSTP) from the kernel
- * when we type ctrl-c (ctrl-z) at the keyboard.
+ * then execute it immediately. Otherwise, fork a child process for each
+ * stage of the pipeline and run the job in the context of the children.
+ * If the job is running in the foreground, wait for it to terminate and
+ * then return.  Note: each job must have a unique process group ID so
+ * that our background children don't receive SIGINT (SIGTSTP) from the
+ * kernel when we type ctrl-c (ctrl-z) at the keyboard.
  */
 void eval(const char *cmdline)
 {
-    char *argv[MAXARGS];    /* Argument list execve() */
+    char **argv;            /* Argument list execve() */
     int bg;                 /* Should the job run in bg or fg? */
     int argc;
-    bg = parse_line(cmdline, &argc, argv);
-    if (argv[0] != NULL && !builtin_cmd(argc, argv, STDIN_FILENO, STDOUT_FILENO)) {
-        pid_t pid;
-        mask_signal(SIG_BLOCK, SIGCHLD);
-        if ((pid = fork()) == 0) {   /* Child */
-            mask_signal(SIG_UNBLOCK, SIGCHLD);
-            if (setpgid(0, 0) < 0) { /* put the child in a new process group */
-                unix_error("eval: setpgid failed");
+    struct pipe_size_conf saved_pipe_size = pipe_size_conf;
+    int line_pipe_size = 0; /* pipe size given for this line only? */
+    int bad_size = 0;       /* and it couldn't be parsed? */
+    int timed = 0;          /* time <line>? */
+    struct job_usage usage; /* what the timed line used */
+    struct rusage self;     /* the shell's own usage before the line */
+    pid_t pid = 0;
+    long t_parse = tracing() ? trace_now() : 0;
+    long t_parsed, t_fork = 0;
+    char **traced_argv;     /* argv as it was parsed, for the trace */
+    bg = parse_line(cmdline, &argc, &argv, cmd_arena);
+    traced_argv = argv;
+    t_parsed = tracing() ? trace_now() : 0;
+    if (argv[0] != NULL && argc > 1 && !strcmp(argv[0], "time")) {
+        /* time cmd ... */
+        timed = 1;
+        memmove(argv, argv + 1, argc * sizeof(char *));
+        argc--;
+        clock_gettime(CLOCK_MONOTONIC, &usage.start);
+        getrusage(RUSAGE_SELF, &self);
+    }
+    if (argv[0] != NULL && argc > 2 && !strcmp(argv[0], "pipesz")) {
+        /* pipesz <size> cmd ... */
+        line_pipe_size = 1;
+        if (parse_pipe_size(argv[1], &pipe_size_conf) < 0) {
+            fflush(stdout);
+            fprintf(stderr, "pipesz: %s: must be default, auto or a size in bytes\n", argv[1]);
+            setfgstatus(1);
+            bad_size = 1;
+        } else {
+            memmove(argv, argv + 2, (argc - 1) * sizeof(char *));
+            argc -= 2;
+        }
+    }
+    if (bad_size) {
+        /* nothing to run, but the line still goes into the history */
+    } else if (argv[0] != NULL && (has_pipe(argc, argv) ||
+                            !builtin_cmd(argc, argv, STDIN_FILENO, STDOUT_FILENO))) {
+        resolve_cmds(argc, argv);
+        fflush(stdout);  /* don't let the child inherit buffered output */
+        if (tracing())
+            t_fork = trace_now();
+        if (has_subs(argc, argv)) {
+            /* a helper process starts the substitutions and waits for them */
+            if ((pid = trace_fork()) == 0) {   /* Child */
+                reactor_child();
+                if (setpgid(0, 0) < 0) { /* put the child in a new process group */
+                    unix_error("eval: setpgid failed");
+                }
+                if (subs_exec(argc, argv) == 0) {
+                    _exit(0);
+                }
+                _exit(1);
             }
-            if (subs_exec(argc, argv) == 0) {
-                exit(0);
+            if (pid > 0)
+                addjob(jobs, pid, bg ? BG : FG, cmdline);
+        } else {
+            /* every stage is a child of the shell, in a new process group */
+            int *pos = alloc_arena(cmd_arena, (argc + 1) * sizeof(int));
+            int stages;
+            if (tracing()) {    /* parse_pipe cuts argv at the pipes */
+                traced_argv = alloc_arena(cmd_arena, (argc + 1) * sizeof(char *));
+                memcpy(traced_argv, argv, (argc + 1) * sizeof(char *));
             }
-            exit(1);
-        } else {/* Parent */
-            if (!bg)
-                addjob(jobs, pid, FG, cmdline);
-            else
-                addjob(jobs, pid, BG, cmdline);
-
-            mask_signal(SIG_UNBLOCK, SIGCHLD);
+            stages = parse_pipe(argc, argv, pos);
+            pid_t *pids = alloc_arena(cmd_arena, stages * sizeof(pid_t));
+            int *watch_fds = alloc_arena(cmd_arena, stages * sizeof(int));
+            if ((pid = launch_pipeline(argv, pos, stages, 0, pids, watch_fds)) > 0)
+                addpipeline(jobs, pids, watch_fds, stages, bg ? BG : FG, cmdline);
+        }
+        if (pid > 0)    /* Parent */
+            watch_job(getjobpid(jobs, pid));
+        if (tracing())
+            trace_cmd(argc, traced_argv, bg, t_parse, t_parsed, t_fork, pid);
 
-            /* handle the started job */
+        /* handle the started job */
+        if (pid > 0) {
             if (!bg)
                 waitfg(pid, STDOUT_FILENO);
             else
                 printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline);
         }
+    } else if (argv[0] != NULL && tracing()) {
+        trace_cmd(argc, argv, bg, t_parse, t_parsed, 0, 0);
     }
+    if (timed && !bg)
+        time_line(pid, &usage, &self);
     if (argv[0] != NULL && strcmp(argv[0], "fc") != 0) {
         save_history(cmdline);
     }
+    if (line_pipe_size) {
+        pipe_size_conf = saved_pipe_size;
+    }
 }
 
-void parse_redirect(char **argv, int *input_fd, int *output_fd)
+/*
+ * time_line - Print what a timed line used. A job that ran to the end
+ *     has its usage from wait4; for a builtin, or a job that was stopped
+ *     or interrupted, the shell's own cpu time is shown instead.
+ */
+void time_line(pid_t pid, struct job_usage *usage, const struct rusage *self)
 {
-    int i = 0;
-    int argc = 0;
-    int last = 0;
-    int fd;
-    while (argv[i] != NULL) {
-        if (strcmp(argv[i], ">") == 0) {
-            last = 1;
-        } else if (strcmp(argv[i], "<") == 0) {
-            last = 2;
-        } else {
-            if (last == 0) {
-                argv[argc++] = argv[i];
-            } else if (last == 1) {
-                if ((fd = open(argv[i], O_CREAT | O_TRUNC | O_RDWR, 0644)) == -1) {
-                    app_error("Fail to create the file!");
-                } else {
-                    *output_fd = fd;
-                }
-            } else if (last == 2) {
-                if ((fd = open(argv[i], O_RDONLY)) == -1) {
-                    app_error("Fail to open the file!");
-                } else {
-                    *input_fd = fd;
-                }
-            }
-            last = 0;
-        }
-        i++;
-    }
-    argv[argc] = NULL;
+    struct job_usage job_usage;
+    struct rusage now;
+    struct timespec start = usage->start;
+    if (pid > 0 && getfgusage(pid, &job_usage) == 0) {
+        *usage = job_usage;
+        usage->start = start;
+    } else {
+        getrusage(RUSAGE_SELF, &now);
+        timersub(&now.ru_utime, &self->ru_utime, &usage->utime);
+        timersub(&now.ru_stime, &self->ru_stime, &usage->stime);
+        usage->maxrss = now.ru_maxrss;
+        usage->nvcsw = now.ru_nvcsw - self->ru_nvcsw;
+        usage->nivcsw = now.ru_nivcsw - self->ru_nivcsw;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &usage->end);
+    print_usage(STDOUT_FILENO, usage);
 }
 
-int parse_pipe(int argc, char **argv, int *cmd_postions)
+/*
+ * trace_cmd - Trace a command line: its words, its shape (pipeline stages
+ *     and substitutions), when it was parsed and forked, and its job.
+ *     A builtin has no pid and is traced once it has run.
+ */
+void trace_cmd(int argc, char **argv, int bg, long t_parse, long t_parsed, long t_fork, pid_t pid)
 {
-    int j = 1;
-    cmd_postions[0] = 0;
+    int stages = 1, subs = 0;
     for (int i = 0; i < argc; i++) {
-        if (strcmp(argv[i], "|") == 0 && i != 0) {
-            if (i < argc - 1) {
-                cmd_postions[j++] = i + 1;
-            }
-            argv[i] = NULL;
-        }
+        if (is_op(argv[i], TOK_PIPE))
+            stages++;
+        else if (is_op(argv[i], TOK_SUBS_IN) || is_op(argv[i], TOK_SUBS_OUT))
+            subs++;
+    }
+    trace_begin(pid > 0 ? "cmd" : "builtin");
+    trace_argv("argv", argv);
+    trace_int("stages", stages);
+    trace_int("subs", subs);
+    trace_int("bg", bg);
+    trace_int("t_parse", t_parse);
+    trace_int("parse_us", t_parsed - t_parse);
+    if (pid > 0) {
+        trace_int("t_fork", t_fork);
+        trace_int("pid", pid);
+        trace_int("jid", pid2jid(pid));
+        trace_str("launcher", launch_mode_name());
+    } else {
+        trace_int("run_us", trace_now() - t_parsed);
     }
-    return j;
+    trace_end();
 }
 
 void save_history(const char *cmd)
 {
-    strcpy(cmd_history[current], cmd);
-    current = (current + 1) % HISTORY_LIMIT;
-}
-
-void history_exec(int start, int n)
-{
-    const char *cmd;
-    if (0 <= start && start < HISTORY_LIMIT) {
-        for (int i = 0; i < n; i++) {
-            cmd = cmd_history[(start + i) % HISTORY_LIMIT];
-            eval(cmd);
-        }
-    }
-}
-
-int subs_exec(int argc, char **argv)
-{
-    char *subargv[argc];
-    char *arg;
-    int i, j;
-    int size;
-    int fds[2];
-    int buf_pos = 0;
-    int flag = 0;
-    int cmd_count = 0;
-    int status;
-    int result = 0;
-    stack s = create_stack(argc);
-    for (i = 0; i < argc; i++) {
-        if (strcmp(argv[i], ")") != 0) {
-            push(s, argv[i]);
-        } else {
-            j = 0;
-            while (!is_empty(s)) {
-                arg = top_and_pop(s);
-                if (!strcmp(arg, "<(")) {
-                    subargv[j] = NULL;
-                    flag = 0;
-                    break;
-                } else if (!strcmp(arg, ">(")) {
-                    subargv[j] = NULL;
-                    flag = 1;
-                    break;
-                } else {
-                    subargv[j++] = arg;
-                }
-            }
-            reverse_array(subargv, j);
-            pipe(fds);
-            if (fork() == 0) {
-                close(fds[flag]);
-                line_exec(j, subargv, !flag ? -1 : fds[1 - flag], flag ? -1 : fds[1 - flag]);
-            } else {
-                close(fds[1 - flag]);
-                size = sprintf(buf + buf_pos, "/proc/%d/fd/%d", getpid(), fds[flag]) + 1;
-                push(s, buf + buf_pos);
-                buf_pos += size;
-            }
-        }
-    }
-    j = 0;
-    while (!is_empty(s)) {
-        subargv[j++] = top_and_pop(s);
-    }
-    subargv[j] = NULL;
-    reverse_array(subargv, j);
-    line_exec(j, subargv, -1, -1);
-    for (i = 0; i < cmd_count; i++) {
-        wait(&status);
-        result |= status;
-    }
-    exit(result);
+    add_history(cmd);
+    update_history_index();
 }
 
 /*
- * first_tok - Returns a pointer to the first (lowest addy) of the four pointers
- *     that isn't NULL.
+ * history_exec - Run n history entries from start on. The lines they add
+ *     go after the end, so start keeps pointing at the same entries.
  */
-char *first_tok(const char *space, const char *input, const char *output, const char *pipe, const char *right)
+void history_exec(long start, long n)
 {
-    const char *possible[5];
-    unsigned long min;
-    int n = 0;
-    if (space != NULL) {
-        possible[n++] = space;
-    }
-    if (input != NULL) {
-        possible[n++] = input;
-    }
-    if (output != NULL) {
-        possible[n++] = output;
-    }
-    if (pipe != NULL) {
-        possible[n++] = pipe;
-    }
-    if (right != NULL) {
-        possible[n++] = right;
-    }
-    if (n == 0) {
-        return NULL;
-    }
-    min = (unsigned long) possible[0];
-    for (int i = 1; i < n; i++) {
-        if (((unsigned long) possible[i]) < min)
-            min = (unsigned long) possible[i];
+    char *cmd;
+    if (start < 0)
+        return;
+    for (long i = 0; i < n; i++) {
+        if ((cmd = get_history(start + i, cmd_arena)) != NULL)
+            eval(cmd);
     }
-    return (char *) min;
 }
 
 /*
@@ -480,119 +541,25 @@ char *first_tok(const char *space, const char *input, const char *output, const
  */
 void usage(void)
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-Bhpqsw] [-j N] [-T file] [script]\n");
+    printf("   -B   launch echo, printf, pwd, true, false and test instead of running them\n");
     printf("   -h   print this message\n");
+    printf("   -j N run up to N script lines at a time, output kept in order\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -q   do not echo script lines or flush after each one\n");
+    printf("   -s   launch commands with posix_spawn instead of fork\n");
+    printf("   -T f trace every command to file f as JSON lines (or set TSH_TRACE=f)\n");
+    printf("   -w   report shell cpu time spent waiting for foreground jobs\n");
     exit(1);
 }
 
-/*
-* parse_line - Parse the command line and build the argv array.
-* Return true (1) if the user has requested a BG job, false
-* if the user has requested a FG job.
-*/
-int parse_line(const char *cmdline, int *p_argc, char **argv)
-{
-    static char array[MAXLINE]; /* holds local copy of command line */
-    char *buf = array;          /* ptr that traverses command line */
-    char *delim_space;          /* points to first space delimiter */
-    char *delim_in;             /* points to the first < delimiter */
-    char *delim_out;            /* points to the first > delimiter */
-    char *delim_pipe;           /* points to the first | delimiter */
-    char *delim_right;          /* points to the first ) delimiter */
-    char *delim;                /* points to the first delimiter */
-    int argc;               /* number of args */
-    int bg;                     /* background job? */
-    char *last_space = NULL;    /* The address of the last space  */
-
-    strcpy(buf, cmdline);
-    buf[strlen(buf) - 1] = ' ';  /* replace trailing '\n' with space */
-    while (*buf && (*buf == ' ')) /* ignore leading spaces */
-        buf++;
-
-    /* Build the argv list */
-    argc = 0;
-    delim_space = strchr(buf, ' ');
-    delim_in = strchr(buf, '<');
-    delim_out = strchr(buf, '>');
-    delim_pipe = strchr(buf, '|');
-    delim_right = strchr(buf, ')');
-    while ((delim = first_tok(delim_space, delim_in, delim_out, delim_pipe, delim_right))) {
-        if (delim == delim_space) {
-            *delim = '\0';
-            if (strlen(buf) != 0) {
-                argv[argc++] = buf;
-            }
-            last_space = delim;
-        } else if (delim == delim_in) {
-            if ((last_space && last_space != (delim - 1)) || !last_space) {
-                *delim = '\0';
-                if (strlen(buf) != 0) {
-                    argv[argc++] = buf;
-                }
-            }
-            if (*(delim + 1) == '(') {
-                delim++;
-                argv[argc++] = "<(";
-            } else {
-                argv[argc++] = "<";
-            }
-            last_space = 0;
-        } else if (delim == delim_out) {
-            if ((last_space && last_space != (delim - 1)) || !last_space) {
-                *delim = '\0';
-                if (strlen(buf) != 0) {
-                    argv[argc++] = buf;
-                }
-            }
-            if (*(delim + 1) == '(') {
-                delim++;
-                argv[argc++] = ">(";
-            } else {
-                argv[argc++] = ">";
-            }
-            last_space = 0;
-        } else if (delim == delim_pipe) {
-            if ((last_space && last_space != (delim - 1)) || !last_space) {
-                *delim = '\0';
-                if (strlen(buf) != 0) {
-                    argv[argc++] = buf;
-                }
-            }
-            argv[argc++] = "|";
-            last_space = 0;
-        } else if (delim == delim_right) {
-            if ((last_space && last_space != (delim - 1)) || !last_space) {
-                *delim = '\0';
-                if (strlen(buf) != 0) {
-                    argv[argc++] = buf;
-                }
-            }
-            argv[argc++] = ")";
-            last_space = 0;
-        }
-        buf = delim + 1;
-        while (*buf && (*buf == ' ')) /* ignore spaces */
-            buf++;
-        delim_space = strchr(buf, ' ');
-        delim_in = strchr(buf, '<');
-        delim_out = strchr(buf, '>');
-        delim_pipe = strchr(buf, '|');
-        delim_right = strchr(buf, ')');
-    }
-    argv[argc] = NULL;
-    if (argc == 0)  /* ignore blank line */
-        return 1;
-    /* should the job run in the background? */
-    if ((bg = (*argv[argc - 1] == '&')) != 0)
-        argv[--argc] = NULL;
-    *p_argc = argc;
-    return bg;
-}
-
 void change_dir(const char *path)
 {
-    if (path != NULL && chdir(path) < 0) {
+    char dir[PATH_MAX];
+    if (path != NULL && chdir(path) == 0) {
+        if (getcwd(dir, sizeof(dir)) != NULL)
+            record_dir(dir);
+    } else if (path != NULL) {
         if (errno == ENOTDIR) {
             printf("cd: %s: Not a directory\n", path);
         } else if (errno == ENOENT) {
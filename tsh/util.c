@@ -1,4 +1,8 @@
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "util.h"
 
 /*
  * For debug
@@ -19,3 +23,28 @@ void reverse_array(char **array, int size)
         array[size - 1 - i] = t;
     }
 }
+
+/* dev_fd_arg - Returns N if arg is "/dev/fd/N", -1 otherwise */
+int dev_fd_arg(const char *arg)
+{
+    char *end;
+    long fd;
+    if (strncmp(arg, "/dev/fd/", 8) != 0 || arg[8] < '0' || arg[8] > '9')
+        return -1;
+    fd = strtol(arg + 8, &end, 10);
+    return *end == '\0' && fd <= 65535 ? (int) fd : -1;
+}
+
+/* join_args - Returns the words of argv joined by spaces, allocated from a */
+char *join_args(int argc, char **argv, arena a)
+{
+    size_t len = 1;
+    char *s, *p;
+    for (int i = 0; i < argc; i++)
+        len += strlen(argv[i]) + 1;
+    p = s = alloc_arena(a, len);
+    *s = '\0';
+    for (int i = 0; i < argc; i++)
+        p += sprintf(p, i > 0 ? " %s" : "%s", argv[i]);
+    return s;
+}
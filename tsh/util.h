@@ -1,6 +1,8 @@
 #ifndef OS_HW_UTIL_H
 #define OS_HW_UTIL_H
 
+#include "arena.h"
+
 #define max(x, y) (((x) > (y)) ? (x) : (y))
 
 #define min(x, y) (((x) < (y)) ? (x) : (y))
@@ -11,4 +13,8 @@ void reverse_array(char **array, int size);
 
 void print_argv(int argc, char **argv);
 
+int dev_fd_arg(const char *arg);
+
+char *join_args(int argc, char **argv, arena a);
+
 #endif //OS_HW_UTIL_H
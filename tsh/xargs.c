@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "xargs.h"
+#include "exec.h"
+#include "trace.h"
+#include "spawn.h"
+#include "sigutil.h"
+#include "reactor.h"
+#include "errmsg.h"
+#include "arena.h"
+#include "job.h"
+#include "util.h"
+
+#define XARGS_BUF      (64 << 10)   /* read size for the items */
+#define XARGS_HEADROOM 2048         /* ARG_MAX room left for the kernel */
+#define XARGS_STATUS   123          /* status if any command failed */
+
+extern char **environ;
+
+/* The command being built and the commands running */
+struct xargs_state
+{
+    char **argv;        /* command words, then the items of this batch */
+    int fixed;          /* number of command words */
+    int argc;
+    int cap;
+    long budget;        /* bytes of ARG_MAX the items may use */
+    long used;
+    int max_items;      /* -n, 0 for no limit */
+    int input_fd;       /* stdin of the commands, -1 to inherit */
+    int output_fd;
+    pid_t *slots;       /* running commands, 0 for a free slot */
+    int *stages;        /* in the shell: the stage of the job each one is */
+    int nslots;         /* -P */
+    int in_shell;       /* the commands are a job of the shell's */
+    pid_t job;          /* that job, 0 before the first command */
+    char *cmdline;      /* and its command line */
+    int stopped;        /* ctrl-c or ctrl-z: launch no more commands */
+    int result;
+    arena items;        /* the items of this batch */
+};
+
+/* arg_size - Bytes a word takes in the kernel's argument area */
+static long arg_size(const char *s)
+{
+    return (long) (strlen(s) + 1 + sizeof(char *));
+}
+
+/* arg_budget - ARG_MAX less the environment, the headroom and the command */
+static long arg_budget(char **cmd, int n)
+{
+    long budget = sysconf(_SC_ARG_MAX);
+    if (budget <= 0)
+        budget = 128 << 10;  /* the POSIX minimum is far lower, the old Linux limit */
+    budget -= XARGS_HEADROOM + (long) sizeof(char *);
+    for (char **env = environ; *env != NULL; env++)
+        budget -= arg_size(*env);
+    for (int i = 0; i < n; i++)
+        budget -= arg_size(cmd[i]);
+    return budget;
+}
+
+/*
+ * reap_job_slots - Wait in the reactor until some of the commands have
+ *     exited, and free their slots. In the shell the commands are the
+ *     stages of one foreground job, so ctrl-c and ctrl-z reach them as
+ *     they would a pipeline; after either, no more commands are launched.
+ */
+static void reap_job_slots(struct xargs_state *x)
+{
+    struct job_t *job;
+    int freed = 0;
+    int found, status = 0;
+    for (;;) {
+        for (int i = 0; i < x->nslots; i++) {
+            if (x->slots[i] == 0 || (found = stagestatus(jobs, x->job, x->stages[i], &status)) > 0)
+                continue;
+            x->slots[i] = 0;
+            freed = 1;
+            if (found < 0 || WIFSIGNALED(status))
+                x->stopped = 1;
+            if (found < 0 || status != 0)
+                x->result = XARGS_STATUS;
+        }
+        if (freed)
+            return;
+        if ((job = getjobpid(jobs, x->job)) != NULL && job->state != FG) {
+            /* stopped: what's running is left to fg and bg */
+            memset(x->slots, 0, x->nslots * sizeof(pid_t));
+            x->stopped = 1;
+            x->result = XARGS_STATUS;
+            return;
+        }
+        run_reactor(-1, -1);
+    }
+}
+
+/* reap_slot - Wait for one running command to exit, and free its slot */
+static void reap_slot(struct xargs_state *x)
+{
+    sigset_t chld;
+    int status;
+    if (x->in_shell) {
+        reap_job_slots(x);
+        return;
+    }
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    for (;;) {
+        for (int i = 0; i < x->nslots; i++) {
+            if (x->slots[i] > 0 && waitpid(x->slots[i], &status, WNOHANG) == x->slots[i]) {
+                x->slots[i] = 0;
+                if (status != 0)
+                    x->result = XARGS_STATUS;
+                return;
+            }
+        }
+        sigwaitinfo(&chld, NULL);
+    }
+}
+
+/* launch - Run the command over the items collected so far */
+static void launch(struct xargs_state *x)
+{
+    int slot = -1;
+    pid_t pgid = -1;    /* in a stage, the stage's own group */
+    pid_t pid;
+    if (x->argc == x->fixed)
+        return;
+    x->argv[x->argc] = NULL;
+    while (slot < 0 && !x->stopped) {
+        for (int i = 0; i < x->nslots && slot < 0; i++)
+            if (x->slots[i] == 0)
+                slot = i;
+        if (slot < 0)
+            reap_slot(x);
+    }
+    if (x->stopped) {
+        x->argc = x->fixed;
+        x->used = 0;
+        clear_arena(x->items);
+        return;
+    }
+    if (x->in_shell) {
+        /* a new job once the last one has ended, in a group of its own */
+        if (getjobpid(jobs, x->job) == NULL)
+            x->job = 0;
+        pgid = x->job;
+    }
+    if (launch_mode == LAUNCH_SPAWN) {
+        pid = spawn_exec(x->argv, x->input_fd, x->output_fd, pgid, NULL, 0);
+    } else {
+        fflush(stdout);
+        if ((pid = trace_fork()) == 0) {
+            reactor_child();
+            if (pgid >= 0 && setpgid(0, pgid) < 0)
+                unix_error("xargs: setpgid failed");
+            signal(SIGPIPE, SIG_DFL);
+            single_exec(x->argv, x->input_fd, x->output_fd != STDOUT_FILENO ? x->output_fd : -1);
+        }
+        if (pid > 0 && pgid >= 0)
+            setpgid(pid, pgid > 0 ? pgid : pid);    /* the child does too, whichever is first */
+    }
+    if (pid > 0) {
+        x->slots[slot] = pid;
+        if (x->in_shell) {
+            if (x->job == 0) {
+                addjob(jobs, pid, FG, x->cmdline);
+                x->job = pid;
+                x->stages[slot] = 0;
+            } else {
+                x->stages[slot] = addstage(jobs, x->job, pid);
+            }
+            watch_job(getjobpid(jobs, x->job));
+        }
+    } else {
+        x->result = XARGS_STATUS;
+    }
+    x->argc = x->fixed;
+    x->used = 0;
+    clear_arena(x->items);
+}
+
+/* add_item - Add an item to the batch, launching the batch first if it's full */
+static void add_item(struct xargs_state *x, const char *item)
+{
+    long size = arg_size(item);
+    char **argv;
+    if (x->argc > x->fixed && (x->used + size > x->budget ||
+                               (x->max_items > 0 && x->argc - x->fixed == x->max_items)))
+        launch(x);
+    if (x->argc + 1 == x->cap) {
+        if ((argv = realloc(x->argv, 2 * x->cap * sizeof(char *))) == NULL)
+            app_error("out of space!!");
+        x->argv = argv;
+        x->cap *= 2;
+    }
+    x->argv[x->argc++] = strdup_arena(x->items, item);
+    x->used += size;
+}
+
+/* read_items - Split fd into items on blanks and newlines, or on NULs */
+static int read_items(struct xargs_state *x, int fd, int nul_sep)
+{
+    char buf[XARGS_BUF];
+    char *item;
+    size_t len = 0, cap = 256;
+    ssize_t n;
+    int sep;
+    if ((item = malloc(cap)) == NULL)
+        app_error("out of space!!");
+    while (!x->stopped && (n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "xargs: read error: %s\n", strerror(errno));
+            free(item);
+            return -1;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            sep = nul_sep ? buf[i] == '\0' : (buf[i] == ' ' || buf[i] == '\t' || buf[i] == '\n');
+            if (sep) {
+                if (len > 0 || nul_sep) {
+                    item[len] = '\0';
+                    add_item(x, item);
+                    len = 0;
+                }
+            } else {
+                if (len + 2 > cap && (item = realloc(item, cap *= 2)) == NULL)
+                    app_error("out of space!!");
+                item[len++] = buf[i];
+            }
+        }
+    }
+    if (len > 0 && !x->stopped) {
+        item[len] = '\0';
+        add_item(x, item);
+    }
+    free(item);
+    return 0;
+}
+
+/*
+ * xargs_builtin - xargs [-0] [-a file] [-n max] [-P jobs] [command [args]]
+ *
+ * Run command (echo by default) over the items read from input_fd or
+ * file, as many items per command as ARG_MAX and -n allow, with up to
+ * -P commands running at a time. Returns 123 if any of them failed.
+ */
+int xargs_builtin(int argc, char **argv, int input_fd, int output_fd)
+{
+    static char *default_cmd[] = {"echo", NULL};
+    struct xargs_state x;
+    const char *file = NULL;
+    char **cmd;
+    int nul_sep = 0;
+    int fd = input_fd;
+    int i;
+    sigset_t prev;
+    size_t len;
+
+    fflush(stdout);
+    memset(&x, 0, sizeof(x));
+    x.nslots = 1;
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (!strcmp(argv[i], "--")) {
+            i++;
+            break;
+        } else if (!strcmp(argv[i], "-0")) {
+            nul_sep = 1;
+        } else if (i + 1 < argc && !strcmp(argv[i], "-a")) {
+            file = argv[++i];
+        } else if (i + 1 < argc && !strcmp(argv[i], "-n") && atoi(argv[i + 1]) > 0) {
+            x.max_items = atoi(argv[++i]);
+        } else if (i + 1 < argc && !strcmp(argv[i], "-P") && atoi(argv[i + 1]) > 0) {
+            x.nslots = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "xargs: usage: xargs [-0] [-a file] [-n max] [-P jobs] [command [args]]\n");
+            return 1;
+        }
+    }
+    cmd = i < argc ? argv + i : default_cmd;
+    x.fixed = i < argc ? argc - i : 1;
+    if (file != NULL && (fd = open(file, O_RDONLY | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "xargs: %s: No such file or directory\n", file);
+        return 1;
+    }
+    x.cap = x.fixed + 64;
+    if ((x.argv = malloc(x.cap * sizeof(char *))) == NULL ||
+        (x.slots = calloc(x.nslots, sizeof(pid_t))) == NULL ||
+        (x.stages = calloc(x.nslots, sizeof(int))) == NULL)
+        app_error("out of space!!");
+    memcpy(x.argv, cmd, x.fixed * sizeof(char *));
+    x.argc = x.fixed;
+    x.budget = arg_budget(cmd, x.fixed);
+    /* the commands don't compete with us for the items */
+    x.input_fd = file != NULL ? -1 : open("/dev/null", O_RDONLY | O_CLOEXEC);
+    x.output_fd = output_fd;
+    x.items = create_arena(0);
+
+    /* in the shell the reactor reaps the commands, in a stage they're reaped here */
+    if ((x.in_shell = reactor_running())) {
+        x.cmdline = join_args(argc, argv, cmd_arena);
+        len = strlen(x.cmdline);
+        x.cmdline = strcpy(alloc_arena(cmd_arena, len + 2), x.cmdline);
+        strcpy(x.cmdline + len, "\n");
+    } else {
+        prev = mask_signal(SIG_BLOCK, SIGCHLD);
+    }
+    if (read_items(&x, fd, nul_sep) < 0)
+        x.result = 1;
+    launch(&x);
+    for (i = 0; i < x.nslots; i++) {
+        while (x.slots[i] > 0)
+            reap_slot(&x);
+    }
+    if (!x.in_shell)
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+
+    if (file != NULL)
+        close(fd);
+    if (x.input_fd >= 0)
+        close(x.input_fd);
+    dispose_arena(x.items);
+    free(x.stages);
+    free(x.slots);
+    free(x.argv);
+    return x.result;
+}
@@ -0,0 +1,6 @@
+#ifndef OS_HW_XARGS_H
+#define OS_HW_XARGS_H
+
+int xargs_builtin(int argc, char **argv, int input_fd, int output_fd);
+
+#endif //OS_HW_XARGS_H